@@ -1,47 +1,41 @@
+#include <string.h>
 #include <SDL.h>
 #include "audio.h"
 #include "../common/log.h"
 #include "../mem/dma.h"
+#include "../capture/capture.h"
+#include "../mem/ioreg_names.h"
 
+static audio_sink_type_t sink_type = AUDIO_SINK_SDL;
+static const char* sink_path = NULL;
+static bool sink_chosen = false;
+static bool audio_sync = false; // Only set at startup
+static bool audio_fast_forward = false; // Set from whichever thread handles input
 
-SDL_AudioSpec audio_spec;
-SDL_AudioSpec request;
-SDL_AudioDeviceID audio_dev;
-
-#ifdef ENABLE_AUDIO
-void audio_callback(void* userdata, Uint8* stream, int length) {
-    gba_apu_t* apu = (gba_apu_t*)userdata;
-    float* out = (float*)stream;
-    for (int i = 0; i < length / sizeof(float); i++) {
-        if (apu->bigbuffer.read_index < apu->bigbuffer.write_index) {
-            apu->apu_last_sample = apu->bigbuffer.buf[(apu->bigbuffer.read_index++) % AUDIO_BIGBUFFER_SIZE];
-        }
-        *out++ = apu->apu_last_sample;
-    }
+void set_audio_sink(audio_sink_type_t type, const char* path) {
+    sink_type = type;
+    sink_path = path;
+    sink_chosen = true;
 }
 
-#define s8_min (-127.0f)
-#define s8_max (128.0f)
-#define f32_min (-1.0f)
-#define f32_max (1.0f)
-
-INLINE float convert_sample(byte sample) {
-    int8_t ssample = sample;
-    return ((((float)ssample - s8_min) * (f32_max - f32_min)) / (s8_max - s8_min)) + f32_min;
+void set_audio_sync(bool sync) {
+    audio_sync = sync;
 }
 
-INLINE float mix(gba_apu_t* apu) {
-    float fifo0 = convert_sample(apu->fifo[0].sample);
-    float fifo1 = convert_sample(apu->fifo[1].sample);
-
-    return (fifo0 + fifo1) / 2;
+void set_audio_fast_forward(bool fast_forward) {
+    __atomic_store_n(&audio_fast_forward, fast_forward, __ATOMIC_RELAXED);
 }
 
-void apu_push_sample(gba_apu_t* apu) {
-    uint64_t size = apu->bigbuffer.write_index - apu->bigbuffer.read_index;
-    if (size < AUDIO_BIGBUFFER_SIZE) {
-        float sample = mix(apu);
-        apu->bigbuffer.buf[(apu->bigbuffer.write_index++) % AUDIO_BIGBUFFER_SIZE] = sample;
+#ifdef ENABLE_AUDIO
+// Clamps to what the 10 bit output can reach around the bias level, and interleaves the two sides. Written as a plain
+// loop over whole blocks so the compiler can vectorize it.
+INLINE void mix_block(const float* restrict left, const float* restrict right, float* restrict out, int count,
+                      float low, float high) {
+    for (int i = 0; i < count; i++) {
+        float l = left[i] < low ? low : left[i];
+        float r = right[i] < low ? low : right[i];
+        out[i * 2] = l > high ? high : l;
+        out[i * 2 + 1] = r > high ? high : r;
     }
 }
 
@@ -49,39 +43,23 @@ void apu_push_sample(gba_apu_t* apu) {
 gba_apu_t* init_apu(bool enable_audio) {
     gba_apu_t* apu = malloc(sizeof(gba_apu_t));
     memset(apu, 0, sizeof(gba_apu_t));
-    apu->enable_audio = enable_audio;
-#ifdef ENABLE_AUDIO
-    if (apu->enable_audio) {
-        if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-            logfatal("SDL couldn't initialize! %s", SDL_GetError())
-        }
-
-        memset(&request, 0, sizeof(request));
-
-        request.freq = AUDIO_SAMPLE_RATE;
-        request.format = AUDIO_F32SYS;
-        request.channels = 1;
-        request.samples = 1024;
-        request.callback = audio_callback;
-        request.userdata = apu;
-        audio_dev = SDL_OpenAudioDevice(NULL, 0, &request, &audio_spec, 0);
-        unimplemented(request.format != audio_spec.format, "Request != got")
-
-        if (audio_dev == 0) {
-            logfatal("Failed to initialize SDL audio: %s", SDL_GetError());
-        }
-
-        SDL_PauseAudioDevice(audio_dev, false);
+    for (int side = 0; side < AUDIO_CHANNELS; side++) {
+        apu->blip[side] = blip_new(CPU_FREQUENCY, AUDIO_SAMPLE_RATE);
     }
+    apu->psg.sequencer_countdown = PSG_SEQUENCER_CYCLES;
+    apu->SOUNDBIAS.raw = 0x0200;
+#ifdef ENABLE_AUDIO
+    // Without a frontend there's nothing to play to, unless a sink was asked for
+    apu->sink = audio_sink_open(enable_audio || sink_chosen ? sink_type : AUDIO_SINK_NULL, sink_path);
+#else
+    apu->sink = audio_sink_open(AUDIO_SINK_NULL, NULL);
 #endif
+    apu->generate_samples = apu->sink->type != AUDIO_SINK_NULL || capture_active();
     return apu;
 }
 
 void write_fifo(gba_apu_t* apu, int channel, word value, word mask) {
 #ifdef ENABLE_AUDIO
-    if (!apu->enable_audio) {
-        return;
-    }
     unimplemented(channel > 1, "tried to fill FIFO >1")
     int size = apu->fifo[channel].write_index - apu->fifo[channel].read_index;
     if (size <= 28) {
@@ -96,6 +74,21 @@ void write_fifo(gba_apu_t* apu, int channel, word value, word mask) {
 #endif
 }
 
+void fill_fifo(gba_apu_t* apu, int channel, const byte* data, int length) {
+#ifdef ENABLE_AUDIO
+    sound_fifo_t* fifo = &apu->fifo[channel];
+    int room = (SOUND_FIFO_SIZE - (int)(fifo->write_index - fifo->read_index)) & ~3;
+    if (length > room) {
+        length = room;
+    }
+    int offset = fifo->write_index % SOUND_FIFO_SIZE;
+    int first = length < SOUND_FIFO_SIZE - offset ? length : SOUND_FIFO_SIZE - offset;
+    memcpy(&fifo->buf[offset], data, first);
+    memcpy(fifo->buf, data + first, length - first);
+    fifo->write_index += length;
+#endif
+}
+
 #ifdef ENABLE_AUDIO
 INLINE void dmasound_tick(gba_apu_t* apu, int channel) {
     uint64_t* wi = &apu->fifo[channel].write_index;
@@ -107,13 +100,11 @@ INLINE void dmasound_tick(gba_apu_t* apu, int channel) {
     } else {
         apu->fifo[channel].sample = 0;
     }
+    apu_set_output(apu, APU_FIFO_CHANNEL(channel), apu->clock, (int8_t)apu->fifo[channel].sample);
 }
 #endif
 void sound_timer_overflow(gba_apu_t* apu, int n) {
 #ifdef ENABLE_AUDIO
-    if (!apu->enable_audio) {
-        return;
-    }
     unimplemented(n > 1, "DMA sound from timer >1")
 
     if (apu->SOUNDCNT_H.dmasound_a_timer_select == n) {
@@ -126,3 +117,161 @@ void sound_timer_overflow(gba_apu_t* apu, int n) {
     gba_dma();
 #endif
 }
+
+void apu_set_output(gba_apu_t* apu, int channel, word time, int output) {
+    apu->output[channel] = output;
+    if (!apu->generate_samples) {
+        return;
+    }
+    for (int side = 0; side < AUDIO_CHANNELS; side++) {
+        float level = output * apu->gain[channel][side];
+        float delta = level - apu->level[channel][side];
+        if (delta != 0) {
+            blip_add_delta(apu->blip[side], time, delta);
+            apu->level[channel][side] = level;
+            apu->amplitude[side] += delta;
+        }
+    }
+}
+
+// Gains are in steps of the 10 bit output, which is 512 steps either side of the bias level, so 1.0 is full scale.
+// A DMA sample counts 4 steps at 100% volume and 2 at 50%. A PSG channel's 0-15 counts the master volume of its side
+// plus one, which the whole PSG then scales down by SOUNDCNT_H.
+INLINE void update_gains(gba_apu_t* apu) {
+    float psg_ratio = apu->SOUNDCNT_H.gbsound_volume == 0 ? 0.25f : apu->SOUNDCNT_H.gbsound_volume == 1 ? 0.5f : 1.0f;
+    for (int n = 0; n < PSG_CHANNELS; n++) {
+        bool left = apu->SOUNDCNT_L.psg_enable_left & (1 << n);
+        bool right = apu->SOUNDCNT_L.psg_enable_right & (1 << n);
+        apu->gain[n][AUDIO_LEFT] = left ? (apu->SOUNDCNT_L.psg_volume_left + 1) * psg_ratio / 512 : 0;
+        apu->gain[n][AUDIO_RIGHT] = right ? (apu->SOUNDCNT_L.psg_volume_right + 1) * psg_ratio / 512 : 0;
+    }
+
+    float fifo_a = (apu->SOUNDCNT_H.dmasound_a_volume ? 4.0f : 2.0f) / 512;
+    float fifo_b = (apu->SOUNDCNT_H.dmasound_b_volume ? 4.0f : 2.0f) / 512;
+    apu->gain[APU_FIFO_CHANNEL(0)][AUDIO_LEFT] = apu->SOUNDCNT_H.dmasound_a_enable_left ? fifo_a : 0;
+    apu->gain[APU_FIFO_CHANNEL(0)][AUDIO_RIGHT] = apu->SOUNDCNT_H.dmasound_a_enable_right ? fifo_a : 0;
+    apu->gain[APU_FIFO_CHANNEL(1)][AUDIO_LEFT] = apu->SOUNDCNT_H.dmasound_b_enable_left ? fifo_b : 0;
+    apu->gain[APU_FIFO_CHANNEL(1)][AUDIO_RIGHT] = apu->SOUNDCNT_H.dmasound_b_enable_right ? fifo_b : 0;
+
+    for (int channel = 0; channel < APU_CHANNELS; channel++) {
+        apu_set_output(apu, channel, apu->clock, apu->output[channel]);
+    }
+}
+
+half* apu_ioreg_ptr(gba_apu_t* apu, word regnum) {
+    psg_run(apu, apu->clock);
+    switch (regnum) {
+        case IO_SOUND1CNT_L: return &apu->psg.SOUND1CNT_L.raw;
+        case IO_SOUND1CNT_H: return &apu->psg.SOUND1CNT_H.raw;
+        case IO_SOUND1CNT_X: return &apu->psg.SOUND1CNT_X.raw;
+        case IO_SOUND2CNT_L: return &apu->psg.SOUND2CNT_L.raw;
+        case IO_SOUND2CNT_H: return &apu->psg.SOUND2CNT_H.raw;
+        case IO_SOUND3CNT_L: return &apu->psg.SOUND3CNT_L.raw;
+        case IO_SOUND3CNT_H: return &apu->psg.SOUND3CNT_H.raw;
+        case IO_SOUND3CNT_X: return &apu->psg.SOUND3CNT_X.raw;
+        case IO_SOUND4CNT_L: return &apu->psg.SOUND4CNT_L.raw;
+        case IO_SOUND4CNT_H: return &apu->psg.SOUND4CNT_H.raw;
+        case IO_SOUNDCNT_L: return &apu->SOUNDCNT_L.raw;
+        case IO_SOUNDCNT_H: return &apu->SOUNDCNT_H.raw;
+        case IO_SOUNDBIAS: return &apu->SOUNDBIAS.raw;
+        case IO_SOUNDCNT_X: {
+            half on = 0;
+            for (int n = 0; n < PSG_CHANNELS; n++) {
+                on |= apu->psg.channel[n].enabled << n;
+            }
+            apu->SOUNDCNT_X.psg_on = on;
+            return &apu->SOUNDCNT_X.raw;
+        }
+        case WAVE_RAM0_L:
+        case WAVE_RAM0_H:
+        case WAVE_RAM1_L:
+        case WAVE_RAM1_H:
+        case WAVE_RAM2_L:
+        case WAVE_RAM2_H:
+        case WAVE_RAM3_L:
+        case WAVE_RAM3_H:
+            return psg_wave_ram_ptr(apu, regnum);
+        default:
+            logfatal("Access to unknown sound register: 0x%03X", regnum)
+    }
+}
+
+void apu_ioreg_written(gba_apu_t* apu, word regnum) {
+    switch (regnum) {
+        case IO_SOUNDCNT_H:
+            for (int channel = 0; channel < 2; channel++) {
+                bool reset = channel == 0 ? apu->SOUNDCNT_H.dmasound_a_reset_fifo : apu->SOUNDCNT_H.dmasound_b_reset_fifo;
+                if (reset) {
+                    apu->fifo[channel].read_index = 0;
+                    apu->fifo[channel].write_index = 0;
+                }
+            }
+            // Write only
+            apu->SOUNDCNT_H.dmasound_a_reset_fifo = false;
+            apu->SOUNDCNT_H.dmasound_b_reset_fifo = false;
+            update_gains(apu);
+            break;
+        case IO_SOUNDCNT_L:
+            update_gains(apu);
+            break;
+        case IO_SOUNDCNT_X:
+            psg_write(apu, regnum);
+            update_gains(apu); // Turning the PSG off clears SOUNDCNT_L
+            break;
+        default:
+            psg_write(apu, regnum);
+            break;
+    }
+}
+
+void apu_end_frame(gba_apu_t* apu) {
+    psg_run(apu, apu->clock);
+    word clock = apu->clock;
+    apu->clock = 0;
+    apu->psg.clock = 0;
+
+    bool generated = apu->generate_samples;
+    // Capture can start at any time, and needs samples whatever the sink is
+    apu->generate_samples = apu->sink->type != AUDIO_SINK_NULL || capture_active();
+    if (!generated) {
+        return;
+    }
+
+    float sides[AUDIO_CHANNELS][BLIP_BUFFER_SIZE];
+    int count = 0;
+    for (int side = 0; side < AUDIO_CHANNELS; side++) {
+        blip_end_frame(apu->blip[side], clock);
+        count = blip_read_samples(apu->blip[side], sides[side], BLIP_BUFFER_SIZE);
+    }
+
+    // Output is relative to the bias level, so it sets how far each way there is to clip
+    int bias = apu->SOUNDBIAS.bias_level << 1;
+    float samples[BLIP_BUFFER_SIZE * AUDIO_CHANNELS];
+    mix_block(sides[AUDIO_LEFT], sides[AUDIO_RIGHT], samples, count, -bias / 512.0f, (0x3FF - bias) / 512.0f);
+    count *= AUDIO_CHANNELS;
+
+    capture_audio_samples(samples, count);
+    if (!apu->sink->push) {
+        return;
+    }
+
+    bool device = apu->sink->type == AUDIO_SINK_SDL;
+    if (device && audio_sync && !__atomic_load_n(&audio_fast_forward, __ATOMIC_RELAXED)) {
+        // Bounded, in case the device has stopped pulling samples
+        for (int waited = 0; audio_ring_available(apu->sink->ring) > AUDIO_RING_TARGET && waited < 100; waited++) {
+            SDL_Delay(1);
+        }
+    }
+    apu->sink->push(apu->sink, samples, count);
+
+    // Capture has to stay at exactly AUDIO_SAMPLE_RATE to stay in step with the video, and with audio sync the ring
+    // can't drift in the first place. Only a real device drains the ring at its own pace.
+    if (device && !audio_sync && !capture_active()) {
+        double fill = (double)audio_ring_available(apu->sink->ring) / AUDIO_RING_SIZE;
+        double target = (double)AUDIO_RING_TARGET / AUDIO_RING_SIZE;
+        double ratio = 1 + (target - fill) * 2 * AUDIO_MAX_RATE_DELTA;
+        for (int side = 0; side < AUDIO_CHANNELS; side++) {
+            blip_set_rates(apu->blip[side], CPU_FREQUENCY, AUDIO_SAMPLE_RATE * ratio);
+        }
+    }
+}
@@ -5,12 +5,28 @@
 #include <stdbool.h>
 
 #include "../common/util.h"
+#include "audio_ring.h"
+#include "audio_sink.h"
+#include "blip_buf.h"
+#include "psg.h"
 
 #define SOUND_FIFO_SIZE 32
+#define SOUND_DMA_BYTES 16 // Moved by every sound DMA
 #define AUDIO_SAMPLE_RATE 48000
-#define AUDIO_BIGBUFFER_SIZE (4096)
+#define AUDIO_CHANNELS 2 // Interleaved left, right everywhere samples are passed around
+#define AUDIO_LEFT 0
+#define AUDIO_RIGHT 1
 #define CPU_FREQUENCY (16*1024*1024)
-#define SAMPLE_EVERY_CYCLES (CPU_FREQUENCY/AUDIO_SAMPLE_RATE)
+// Audio is normally resampled once a frame, but if nobody ends the frame (tests stepping the CPU directly) it's done
+// after this many cycles anyway so the blip buffer can't overflow
+#define APU_MAX_FRAME_CYCLES (CPU_FREQUENCY / 32)
+// Dynamic rate control keeps the ring around this full, by playing the output up to AUDIO_MAX_RATE_DELTA faster or
+// slower than AUDIO_SAMPLE_RATE. The display runs at 60Hz against the GBA's 59.73, so that has to cover about 0.5%.
+#define AUDIO_RING_TARGET (AUDIO_RING_SIZE / 2)
+#define AUDIO_MAX_RATE_DELTA 0.01
+// PSG channels 0-3, then DMA sound A and B
+#define APU_CHANNELS (PSG_CHANNELS + 2)
+#define APU_FIFO_CHANNEL(n) (PSG_CHANNELS + (n))
 
 typedef union SOUNDCNT_H {
     struct {
@@ -31,9 +47,15 @@ typedef union SOUNDCNT_H {
     half raw;
 } SOUNDCNT_H_t;
 
-typedef union SOUNDCNT_L {
+typedef union SOUNDBIAS {
+    struct {
+        unsigned:1;
+        unsigned bias_level:9;
+        unsigned:4;
+        unsigned amplitude_resolution:2;
+    };
     half raw;
-} SOUNDCNT_L_t;
+} SOUNDBIAS_t;
 
 typedef struct sound_fifo {
     byte buf[SOUND_FIFO_SIZE];
@@ -42,30 +64,46 @@ typedef struct sound_fifo {
     byte sample;
 } sound_fifo_t;
 
-typedef struct sound_bigbuffer {
-    float buf[AUDIO_BIGBUFFER_SIZE];
-    uint64_t read_index;
-    uint64_t write_index;
-} sound_bigbuffer_t;
-
 typedef struct gba_apu {
     sound_fifo_t fifo[2];
-    sound_bigbuffer_t bigbuffer;
+    gba_psg_t psg;
+    audio_sink_t* sink;
 
     SOUNDCNT_H_t SOUNDCNT_H;
     SOUNDCNT_L_t SOUNDCNT_L;
-    word apu_cycle_counter;
-    float apu_last_sample;
-    bool enable_audio;
+    SOUNDCNT_X_t SOUNDCNT_X;
+    SOUNDBIAS_t SOUNDBIAS;
+    blip_buffer_t* blip[AUDIO_CHANNELS];
+    word clock;                      // Cycles since the start of the current audio frame
+    float amplitude[AUDIO_CHANNELS]; // Output level of each side, as of the last delta added to its blip buffer
+    int output[APU_CHANNELS];        // What each channel puts out: 0-15 for the PSG, signed 8 bit for DMA sound
+    float gain[APU_CHANNELS][AUDIO_CHANNELS]; // Level per step of output on each side, from the mixer settings
+    float level[APU_CHANNELS][AUDIO_CHANNELS];
+    bool generate_samples; // Off for the null sink, when nothing would ever hear them
 } gba_apu_t;
 
+// Plays through SDL, unless set_audio_sink picked something else. Without enable_audio the default is the null sink.
 gba_apu_t* init_apu(bool enable_audio);
+void set_audio_sink(audio_sink_type_t type, const char* path);
+// Paces emulation to the audio device: the end of each frame waits for the ring to drain down to AUDIO_RING_TARGET
+void set_audio_sync(bool sync);
+// Stops audio sync holding emulation back while it's on. Safe to call from any thread.
+void set_audio_fast_forward(bool fast_forward);
 void sound_timer_overflow(gba_apu_t* apu, int n);
 void write_fifo(gba_apu_t* apu, int channel, word value, word mask);
-void apu_push_sample(gba_apu_t* apu);
+// Sound DMA. Takes as many whole words of data as there's room for, like that many write_fifo calls would
+void fill_fifo(gba_apu_t* apu, int channel, const byte* data, int length);
+// Sound registers 0x060-0x09F. The PSG is caught up before the pointer is handed out, so it sees register changes at
+// the right time, and apu_ioreg_written has to be called after every write through it.
+half* apu_ioreg_ptr(gba_apu_t* apu, word regnum);
+void apu_ioreg_written(gba_apu_t* apu, word regnum);
+// Sets what one channel puts out, as of the given cycle of the current audio frame
+void apu_set_output(gba_apu_t* apu, int channel, word time, int output);
+// Resamples everything since the last call, and hands it to the audio device and capture
+void apu_end_frame(gba_apu_t* apu);
 #ifdef ENABLE_AUDIO
-#define apu_tick(apu) do { if (++apu->apu_cycle_counter > SAMPLE_EVERY_CYCLES) { apu->apu_cycle_counter = 0; apu_push_sample(apu); } } while(0)
+#define apu_advance(apu, cycles) do { if ((apu->clock += (cycles)) >= APU_MAX_FRAME_CYCLES) { apu_end_frame(apu); } } while(0)
 #else
-#define apu_tick(apu) do {} while(0)
+#define apu_advance(apu, cycles) do {} while(0)
 #endif
 #endif //GBA_AUDIO_H
@@ -0,0 +1,78 @@
+#ifndef GBA_AUDIO_RING_H
+#define GBA_AUDIO_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../common/util.h"
+
+// Single producer (the emulation thread), single consumer (the SDL audio callback) ring of samples. Each side only
+// ever writes its own index, publishing it with release and reading the other's with acquire, so no locks are needed.
+// The indices only ever increase, and are kept on separate cache lines so the two threads don't bounce one line back
+// and forth on every sample.
+
+#define AUDIO_RING_SIZE 8192 // Must be a power of two
+#define AUDIO_RING_CHANNELS 2 // Samples come in interleaved stereo pairs, and are always pushed and popped as such
+#define AUDIO_RING_MASK (AUDIO_RING_SIZE - 1)
+#define CACHE_LINE_SIZE 64
+
+typedef struct audio_ring {
+    float buf[AUDIO_RING_SIZE];
+
+    // Producer side
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t write_index;
+    uint64_t overruns;  // Samples dropped because the ring was full
+
+    // Consumer side
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t read_index;
+    uint64_t underruns; // Samples the consumer asked for that weren't there yet
+    float last_frame[AUDIO_RING_CHANNELS]; // Repeated to fill underruns
+} audio_ring_t;
+
+INLINE uint64_t audio_ring_available(audio_ring_t* ring) {
+    return atomic_load_explicit(&ring->write_index, memory_order_acquire)
+           - atomic_load_explicit(&ring->read_index, memory_order_acquire);
+}
+
+// Returns how many samples fit, the rest count as overruns
+INLINE int audio_ring_push(audio_ring_t* ring, const float* samples, int count) {
+    uint64_t write = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    uint64_t read = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    int space = AUDIO_RING_SIZE - (int)(write - read);
+    int pushed = count < space ? count : space;
+
+    int offset = write & AUDIO_RING_MASK;
+    int first = pushed < AUDIO_RING_SIZE - offset ? pushed : AUDIO_RING_SIZE - offset;
+    memcpy(&ring->buf[offset], samples, first * sizeof(float));
+    memcpy(ring->buf, samples + first, (pushed - first) * sizeof(float));
+
+    atomic_store_explicit(&ring->write_index, write + pushed, memory_order_release);
+    ring->overruns += count - pushed;
+    return pushed;
+}
+
+// Fills all of out. Whatever the ring can't supply is padded with the last frame it did, and counted as underruns.
+INLINE int audio_ring_pop(audio_ring_t* ring, float* out, int count) {
+    uint64_t read = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    uint64_t write = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+    int available = (int)(write - read);
+    int popped = count < available ? count : available;
+
+    int offset = read & AUDIO_RING_MASK;
+    int first = popped < AUDIO_RING_SIZE - offset ? popped : AUDIO_RING_SIZE - offset;
+    memcpy(out, &ring->buf[offset], first * sizeof(float));
+    memcpy(out + first, ring->buf, (popped - first) * sizeof(float));
+    atomic_store_explicit(&ring->read_index, read + popped, memory_order_release);
+
+    if (popped >= AUDIO_RING_CHANNELS) {
+        memcpy(ring->last_frame, &out[popped - AUDIO_RING_CHANNELS], sizeof(ring->last_frame));
+    }
+    for (int i = popped; i < count; i++) {
+        out[i] = ring->last_frame[i % AUDIO_RING_CHANNELS];
+    }
+    ring->underruns += count - popped;
+    return popped;
+}
+
+#endif //GBA_AUDIO_RING_H
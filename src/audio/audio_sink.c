@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "audio_sink.h"
+#include "audio.h"
+#include "../common/log.h"
+#include "../capture/capture.h"
+
+#define SINK_WRITE_BLOCK 4096
+
+SDL_AudioSpec audio_spec;
+SDL_AudioSpec request;
+SDL_AudioDeviceID audio_dev;
+
+static void audio_callback(void* userdata, Uint8* stream, int length) {
+    audio_sink_t* sink = (audio_sink_t*)userdata;
+    audio_ring_pop(sink->ring, (float*)stream, length / sizeof(float));
+}
+
+// The device takes whatever fits, anything more counts as an overrun
+static void push_to_ring(audio_sink_t* sink, const float* samples, int count) {
+    audio_ring_push(sink->ring, samples, count);
+}
+
+static void open_sdl_device(audio_sink_t* sink) {
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        logfatal("SDL couldn't initialize! %s", SDL_GetError())
+    }
+
+    memset(&request, 0, sizeof(request));
+
+    request.freq = AUDIO_SAMPLE_RATE;
+    request.format = AUDIO_F32SYS;
+    request.channels = AUDIO_CHANNELS;
+    request.samples = 1024;
+    request.callback = audio_callback;
+    request.userdata = sink;
+    audio_dev = SDL_OpenAudioDevice(NULL, 0, &request, &audio_spec, 0);
+    unimplemented(request.format != audio_spec.format, "Request != got")
+
+    if (audio_dev == 0) {
+        logfatal("Failed to initialize SDL audio: %s", SDL_GetError());
+    }
+
+    SDL_PauseAudioDevice(audio_dev, false);
+}
+
+// Files can't drop samples, so this waits for the writer to make room rather than overrunning
+static void push_to_file(audio_sink_t* sink, const float* samples, int count) {
+    while (count > 0) {
+        int pushed = (int)(AUDIO_RING_SIZE - audio_ring_available(sink->ring));
+        if (pushed > count) {
+            pushed = count;
+        }
+        if (pushed == 0) {
+            SDL_SemPost(sink->work_available);
+            SDL_Delay(1);
+            continue;
+        }
+        audio_ring_push(sink->ring, samples, pushed);
+        samples += pushed;
+        count -= pushed;
+    }
+    SDL_SemPost(sink->work_available);
+}
+
+static bool write_available(audio_sink_t* sink) {
+    int count = (int)audio_ring_available(sink->ring);
+    if (count > SINK_WRITE_BLOCK) {
+        count = SINK_WRITE_BLOCK;
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    float samples[SINK_WRITE_BLOCK];
+    int16_t converted[SINK_WRITE_BLOCK];
+    audio_ring_pop(sink->ring, samples, count);
+    capture_convert_samples(samples, converted, count);
+    fwrite(converted, sizeof(int16_t), count, sink->file);
+    sink->bytes_written += count * sizeof(int16_t);
+    return true;
+}
+
+static int sink_writer_main(void* data) {
+    audio_sink_t* sink = data;
+    while (true) {
+        SDL_SemWaitTimeout(sink->work_available, 100);
+        bool stop = __atomic_load_n(&sink->stopping, __ATOMIC_ACQUIRE);
+        while (write_available(sink));
+        if (stop) {
+            return 0;
+        }
+    }
+}
+
+static void open_file(audio_sink_t* sink, const char* path) {
+    if (!path) {
+        logfatal("Audio file sink needs a path")
+    }
+    sink->file = fopen(path, "wb");
+    if (!sink->file) {
+        logfatal("Unable to open %s for audio", path)
+    }
+    if (sink->type == AUDIO_SINK_WAV) {
+        capture_write_wav_header(sink->file, 0);
+    }
+    loginfo("Writing audio to %s", path)
+
+    sink->work_available = SDL_CreateSemaphore(0);
+    sink->writer_thread = SDL_CreateThread(sink_writer_main, "audio sink", sink);
+    if (!sink->writer_thread) {
+        logfatal("Unable to start audio sink thread: %s", SDL_GetError())
+    }
+}
+
+audio_sink_t* audio_sink_open(audio_sink_type_t type, const char* path) {
+    audio_sink_t* sink = malloc(sizeof(audio_sink_t));
+    memset(sink, 0, sizeof(audio_sink_t));
+    sink->type = type;
+    sink->ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(audio_ring_t));
+    memset(sink->ring, 0, sizeof(audio_ring_t));
+
+    switch (type) {
+        case AUDIO_SINK_SDL:
+            sink->push = push_to_ring;
+            open_sdl_device(sink);
+            break;
+        case AUDIO_SINK_WAV:
+        case AUDIO_SINK_RAW:
+            sink->push = push_to_file;
+            open_file(sink, path);
+            break;
+        case AUDIO_SINK_MEMORY:
+            sink->push = push_to_ring;
+            break;
+        case AUDIO_SINK_NULL:
+            sink->push = NULL;
+            break;
+    }
+    return sink;
+}
+
+void audio_sink_close(audio_sink_t* sink) {
+    switch (sink->type) {
+        case AUDIO_SINK_SDL:
+            SDL_CloseAudioDevice(audio_dev);
+            loginfo("Audio: %lu underruns, %lu overruns", (unsigned long)sink->ring->underruns,
+                    (unsigned long)sink->ring->overruns)
+            break;
+        case AUDIO_SINK_WAV:
+        case AUDIO_SINK_RAW:
+            __atomic_store_n(&sink->stopping, true, __ATOMIC_RELEASE);
+            SDL_SemPost(sink->work_available);
+            SDL_WaitThread(sink->writer_thread, NULL);
+            SDL_DestroySemaphore(sink->work_available);
+            if (sink->type == AUDIO_SINK_WAV) {
+                capture_write_wav_header(sink->file, sink->bytes_written);
+            }
+            fclose(sink->file);
+            loginfo("Wrote %lu bytes of audio", (unsigned long)sink->bytes_written)
+            break;
+        case AUDIO_SINK_MEMORY:
+        case AUDIO_SINK_NULL:
+            break;
+    }
+    free(sink->ring);
+    free(sink);
+}
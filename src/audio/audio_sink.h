@@ -0,0 +1,39 @@
+#ifndef GBA_AUDIO_SINK_H
+#define GBA_AUDIO_SINK_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "audio_ring.h"
+
+// Where the APU's samples go at the end of every frame. Every sink but the null one gets the same interleaved stereo
+// samples through its ring; they only differ in who takes them out the other end.
+
+typedef enum audio_sink_type {
+    AUDIO_SINK_SDL,    // The default audio device pulls them from its callback
+    AUDIO_SINK_WAV,    // A writer thread streams them to a 16 bit WAV file
+    AUDIO_SINK_RAW,    // Same, headerless
+    AUDIO_SINK_MEMORY, // They stay in the ring until someone pops them, for tests
+    AUDIO_SINK_NULL    // No samples are generated at all. FIFOs, and the DMA that refills them, still run exactly.
+} audio_sink_type_t;
+
+typedef struct audio_sink {
+    audio_sink_type_t type;
+    audio_ring_t* ring;
+    // Takes a frame's worth of samples, on the emulation thread
+    void (*push)(struct audio_sink* sink, const float* samples, int count);
+
+    // File sinks
+    FILE* file;
+    struct SDL_Thread* writer_thread;
+    struct SDL_semaphore* work_available;
+    bool stopping;
+    word bytes_written;
+} audio_sink_t;
+
+// path is only used by the file sinks
+audio_sink_t* audio_sink_open(audio_sink_type_t type, const char* path);
+// Flushes anything still queued, and frees the sink
+void audio_sink_close(audio_sink_t* sink);
+
+#endif //GBA_AUDIO_SINK_H
@@ -0,0 +1,82 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blip_buf.h"
+#include "../common/log.h"
+
+// Cutoff as a fraction of the output sample rate, a bit under Nyquist to leave the window room to roll off
+#define BLIP_CUTOFF 0.45
+
+blip_buffer_t* blip_new(int clock_rate, int sample_rate) {
+    blip_buffer_t* blip = malloc(sizeof(blip_buffer_t));
+    memset(blip, 0, sizeof(blip_buffer_t));
+    blip_set_rates(blip, clock_rate, sample_rate);
+
+    // Blackman windowed sinc for each phase, normalized so every step adds up to exactly its delta
+    for (int phase = 0; phase < BLIP_PHASES; phase++) {
+        double sum = 0;
+        double kernel[BLIP_TAPS];
+        for (int tap = 0; tap < BLIP_TAPS; tap++) {
+            double t = tap - BLIP_TAPS / 2 + 1 - (double)phase / BLIP_PHASES;
+            double x = 2 * BLIP_CUTOFF * t;
+            double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+            double w = (t + BLIP_TAPS / 2) / BLIP_TAPS;
+            double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+            kernel[tap] = sinc * window;
+            sum += kernel[tap];
+        }
+        for (int tap = 0; tap < BLIP_TAPS; tap++) {
+            blip->kernel[phase][tap] = kernel[tap] / sum;
+        }
+    }
+
+    return blip;
+}
+
+void blip_set_rates(blip_buffer_t* blip, int clock_rate, double sample_rate) {
+    blip->factor = (uint64_t)(sample_rate * 4294967296.0 / clock_rate);
+}
+
+void blip_add_delta(blip_buffer_t* blip, word time, float delta) {
+    uint64_t position = blip->offset + time * blip->factor;
+    int index = position >> 32;
+    int phase = (position >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+    if (index >= BLIP_BUFFER_SIZE) {
+        logfatal("Blip buffer overflowed, the frame ran too long")
+    }
+
+    float* out = &blip->buf[index];
+    const float* kernel = blip->kernel[phase];
+    for (int tap = 0; tap < BLIP_TAPS; tap++) {
+        out[tap] += delta * kernel[tap];
+    }
+}
+
+void blip_end_frame(blip_buffer_t* blip, word clocks) {
+    blip->offset += clocks * blip->factor;
+}
+
+int blip_samples_avail(blip_buffer_t* blip) {
+    return blip->offset >> 32;
+}
+
+int blip_read_samples(blip_buffer_t* blip, float* out, int count) {
+    int avail = blip_samples_avail(blip);
+    if (count > avail) {
+        count = avail;
+    }
+
+    double integrator = blip->integrator;
+    for (int i = 0; i < count; i++) {
+        integrator += blip->buf[i];
+        out[i] = integrator;
+    }
+    blip->integrator = integrator;
+
+    // Steps from later on may already reach into the samples after these, so they have to be kept
+    memmove(blip->buf, &blip->buf[count], (BLIP_BUFFER_SIZE + BLIP_TAPS - count) * sizeof(float));
+    memset(&blip->buf[BLIP_BUFFER_SIZE + BLIP_TAPS - count], 0, count * sizeof(float));
+    blip->offset -= (uint64_t)count << 32;
+    return count;
+}
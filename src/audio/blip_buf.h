@@ -0,0 +1,34 @@
+#ifndef GBA_BLIP_BUF_H
+#define GBA_BLIP_BUF_H
+
+#include "../common/util.h"
+
+// Band-limited synthesis buffer. Rather than point sampling the output, every change in amplitude is added as a
+// band-limited step at the exact clock it happened on. Reading the buffer back integrates those steps into samples at
+// the output rate, with nothing above the output's Nyquist frequency left to alias.
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS) // Sub-sample positions a step can land on
+#define BLIP_TAPS 16        // Width of each step's kernel, in samples. Output lags by half of this.
+#define BLIP_BUFFER_SIZE 4096
+
+typedef struct blip_buffer {
+    uint64_t factor;    // Output samples per clock, 32.32 fixed point
+    uint64_t offset;    // Where clock 0 of the current frame lands, in samples, 32.32 fixed point
+    double integrator;
+    float kernel[BLIP_PHASES][BLIP_TAPS];
+    float buf[BLIP_BUFFER_SIZE + BLIP_TAPS];
+} blip_buffer_t;
+
+blip_buffer_t* blip_new(int clock_rate, int sample_rate);
+// Can be changed between frames, to nudge how many samples come out of each one
+void blip_set_rates(blip_buffer_t* blip, int clock_rate, double sample_rate);
+// Adds a change of delta in amplitude at the given clock of the current frame
+void blip_add_delta(blip_buffer_t* blip, word time, float delta);
+// Ends the current frame after this many clocks, making the samples for it available
+void blip_end_frame(blip_buffer_t* blip, word clocks);
+int blip_samples_avail(blip_buffer_t* blip);
+// Reads up to count finished samples, returns how many were read
+int blip_read_samples(blip_buffer_t* blip, float* out, int count);
+
+#endif //GBA_BLIP_BUF_H
@@ -0,0 +1,334 @@
+#include <string.h>
+
+#include "psg.h"
+#include "audio.h"
+#include "../common/log.h"
+#include "../mem/ioreg_names.h"
+
+static const byte duty_table[4][8] = {
+        {0, 0, 0, 0, 0, 0, 0, 1}, // 12.5%
+        {1, 0, 0, 0, 0, 0, 0, 1}, // 25%
+        {1, 0, 0, 0, 0, 1, 1, 1}, // 50%
+        {0, 1, 1, 1, 1, 1, 1, 0}, // 75%
+};
+
+INLINE bool dac_enabled(gba_psg_t* psg, int n) {
+    // The square and noise DACs are off when the envelope can only ever output 0
+    switch (n) {
+        case 0: return (psg->SOUND1CNT_H.raw & 0xF800) != 0;
+        case 1: return (psg->SOUND2CNT_L.raw & 0xF800) != 0;
+        case 2: return psg->SOUND3CNT_L.dac_enable;
+        case 3: return (psg->SOUND4CNT_L.raw & 0xF800) != 0;
+        default: logfatal("Invalid PSG channel %d", n)
+    }
+}
+
+INLINE SOUNDCNT_ENVELOPE_t* envelope_reg(gba_psg_t* psg, int n) {
+    switch (n) {
+        case 0: return &psg->SOUND1CNT_H;
+        case 1: return &psg->SOUND2CNT_L;
+        case 3: return &psg->SOUND4CNT_L;
+        default: logfatal("PSG channel %d has no envelope", n)
+    }
+}
+
+INLINE bool length_enabled(gba_psg_t* psg, int n) {
+    switch (n) {
+        case 0: return psg->SOUND1CNT_X.length_enable;
+        case 1: return psg->SOUND2CNT_H.length_enable;
+        case 2: return psg->SOUND3CNT_X.length_enable;
+        case 3: return psg->SOUND4CNT_H.length_enable;
+        default: logfatal("Invalid PSG channel %d", n)
+    }
+}
+
+INLINE word channel_period(gba_psg_t* psg, int n) {
+    switch (n) {
+        case 0: return (2048 - psg->SOUND1CNT_X.frequency) * 16;
+        case 1: return (2048 - psg->SOUND2CNT_H.frequency) * 16;
+        case 2: return (2048 - psg->SOUND3CNT_X.frequency) * 8;
+        case 3: {
+            word divisor = psg->SOUND4CNT_H.ratio ? psg->SOUND4CNT_H.ratio * 16 : 8;
+            return (divisor << psg->SOUND4CNT_H.shift) * 4;
+        }
+        default: logfatal("Invalid PSG channel %d", n)
+    }
+}
+
+INLINE byte wave_sample(gba_psg_t* psg, word position) {
+    int bank = psg->SOUND3CNT_L.bank;
+    if (psg->SOUND3CNT_L.two_banks) {
+        bank ^= position >> 5;
+    }
+    byte b = psg->wave_ram[bank][(position & 31) >> 1];
+    byte sample = position & 1 ? b & 0xF : b >> 4;
+
+    if (psg->SOUND3CNT_H.force_volume) {
+        return sample * 3 / 4;
+    }
+    switch (psg->SOUND3CNT_H.volume) {
+        case 0: return 0;
+        case 1: return sample;
+        case 2: return sample >> 1;
+        case 3: return sample >> 2;
+        default: logfatal("Invalid wave volume")
+    }
+}
+
+INLINE byte channel_output(gba_psg_t* psg, int n) {
+    psg_channel_t* ch = &psg->channel[n];
+    if (!ch->enabled) {
+        return 0;
+    }
+    switch (n) {
+        case 0: return duty_table[psg->SOUND1CNT_H.duty][ch->position] ? ch->volume : 0;
+        case 1: return duty_table[psg->SOUND2CNT_L.duty][ch->position] ? ch->volume : 0;
+        case 2: return wave_sample(psg, ch->position);
+        case 3: return ch->position & 1 ? 0 : ch->volume;
+        default: logfatal("Invalid PSG channel %d", n)
+    }
+}
+
+INLINE void update_output(gba_apu_t* apu, int n, word time) {
+    apu_set_output(apu, n, time, channel_output(&apu->psg, n));
+}
+
+INLINE void step_waveform(gba_psg_t* psg, int n) {
+    psg_channel_t* ch = &psg->channel[n];
+    switch (n) {
+        case 0:
+        case 1:
+            ch->position = (ch->position + 1) & 7;
+            break;
+        case 2:
+            ch->position = (ch->position + 1) & (psg->SOUND3CNT_L.two_banks ? 63 : 31);
+            break;
+        case 3: {
+            word feedback = (ch->position ^ (ch->position >> 1)) & 1;
+            ch->position = (ch->position >> 1) | (feedback << 14);
+            if (psg->SOUND4CNT_H.narrow) {
+                ch->position = (ch->position & ~(1 << 6)) | (feedback << 6);
+            }
+            break;
+        }
+        default:
+            logfatal("Invalid PSG channel %d", n)
+    }
+}
+
+// Produces every edge in the channel's output between from and to
+INLINE void generate(gba_apu_t* apu, int n, word from, word to) {
+    psg_channel_t* ch = &apu->psg.channel[n];
+    if (!ch->enabled || !apu->generate_samples) {
+        return;
+    }
+    word time = from;
+    while (to - time >= ch->countdown) {
+        time += ch->countdown;
+        ch->countdown = ch->period;
+        step_waveform(&apu->psg, n);
+        update_output(apu, n, time);
+    }
+    ch->countdown -= to - time;
+}
+
+// Returns the next frequency the sweep would move to, turning the channel off if it would overflow
+INLINE half sweep_calculate(gba_psg_t* psg) {
+    half delta = psg->sweep_frequency >> psg->SOUND1CNT_L.sweep_shift;
+    half frequency = psg->SOUND1CNT_L.sweep_decrease ? psg->sweep_frequency - delta : psg->sweep_frequency + delta;
+    if (frequency > 2047) {
+        psg->channel[0].enabled = false;
+    }
+    return frequency;
+}
+
+INLINE void clock_sweep(gba_psg_t* psg) {
+    if (--psg->sweep_timer > 0) {
+        return;
+    }
+    psg->sweep_timer = psg->SOUND1CNT_L.sweep_time ? psg->SOUND1CNT_L.sweep_time : 8;
+    if (psg->sweep_enabled && psg->SOUND1CNT_L.sweep_time) {
+        half frequency = sweep_calculate(psg);
+        if (frequency <= 2047 && psg->SOUND1CNT_L.sweep_shift) {
+            psg->sweep_frequency = frequency;
+            psg->SOUND1CNT_X.frequency = frequency;
+            psg->channel[0].period = channel_period(psg, 0);
+            sweep_calculate(psg);
+        }
+    }
+}
+
+INLINE void clock_envelope(gba_psg_t* psg, int n) {
+    psg_channel_t* ch = &psg->channel[n];
+    SOUNDCNT_ENVELOPE_t* envelope = envelope_reg(psg, n);
+    if (envelope->envelope_time == 0 || --ch->envelope_timer > 0) {
+        return;
+    }
+    ch->envelope_timer = envelope->envelope_time;
+    if (envelope->envelope_increase && ch->volume < 15) {
+        ch->volume++;
+    } else if (!envelope->envelope_increase && ch->volume > 0) {
+        ch->volume--;
+    }
+}
+
+INLINE void clock_sequencer(gba_apu_t* apu) {
+    gba_psg_t* psg = &apu->psg;
+    byte step = psg->sequencer_step;
+    if ((step & 1) == 0) {
+        for (int n = 0; n < PSG_CHANNELS; n++) {
+            psg_channel_t* ch = &psg->channel[n];
+            if (length_enabled(psg, n) && ch->length > 0 && --ch->length == 0) {
+                ch->enabled = false;
+            }
+        }
+    }
+    if (step == 2 || step == 6) {
+        clock_sweep(psg);
+    }
+    if (step == 7) {
+        clock_envelope(psg, 0);
+        clock_envelope(psg, 1);
+        clock_envelope(psg, 3);
+    }
+    psg->sequencer_step = (step + 1) & 7;
+
+    for (int n = 0; n < PSG_CHANNELS; n++) {
+        update_output(apu, n, psg->clock);
+    }
+}
+
+void psg_run(gba_apu_t* apu, word until) {
+    gba_psg_t* psg = &apu->psg;
+    while (psg->clock < until) {
+        word end = until - psg->clock < psg->sequencer_countdown ? until : psg->clock + psg->sequencer_countdown;
+        for (int n = 0; n < PSG_CHANNELS; n++) {
+            generate(apu, n, psg->clock, end);
+        }
+        psg->sequencer_countdown -= end - psg->clock;
+        psg->clock = end;
+        if (psg->sequencer_countdown == 0) {
+            psg->sequencer_countdown = PSG_SEQUENCER_CYCLES;
+            clock_sequencer(apu);
+        }
+    }
+}
+
+INLINE void trigger(gba_psg_t* psg, int n) {
+    psg_channel_t* ch = &psg->channel[n];
+    ch->enabled = dac_enabled(psg, n);
+    if (ch->length == 0) {
+        ch->length = n == 2 ? 256 : 64;
+    }
+    ch->period = channel_period(psg, n);
+    ch->countdown = ch->period;
+
+    switch (n) {
+        case 0:
+            psg->sweep_frequency = psg->SOUND1CNT_X.frequency;
+            psg->sweep_timer = psg->SOUND1CNT_L.sweep_time ? psg->SOUND1CNT_L.sweep_time : 8;
+            psg->sweep_enabled = psg->SOUND1CNT_L.sweep_time || psg->SOUND1CNT_L.sweep_shift;
+            if (psg->SOUND1CNT_L.sweep_shift) {
+                sweep_calculate(psg);
+            }
+            // fall through
+        case 1:
+        case 3:
+            ch->volume = envelope_reg(psg, n)->envelope_volume;
+            ch->envelope_timer = envelope_reg(psg, n)->envelope_time;
+            if (n == 3) {
+                ch->position = 0x7FFF;
+            }
+            break;
+        case 2:
+            ch->position = 0;
+            break;
+        default:
+            logfatal("Invalid PSG channel %d", n)
+    }
+}
+
+// The length and envelope registers are shared in layout between the square and noise channels
+INLINE void envelope_written(gba_psg_t* psg, int n) {
+    psg->channel[n].length = 64 - envelope_reg(psg, n)->length;
+    if (!dac_enabled(psg, n)) {
+        psg->channel[n].enabled = false;
+    }
+}
+
+INLINE void frequency_written(gba_psg_t* psg, int n, SOUNDCNT_FREQ_t* reg) {
+    // Takes effect the next time the channel's timer reloads
+    psg->channel[n].period = channel_period(psg, n);
+    if (reg->restart) {
+        reg->restart = false; // Write only
+        trigger(psg, n);
+    }
+}
+
+void psg_write(gba_apu_t* apu, word regnum) {
+    gba_psg_t* psg = &apu->psg;
+    switch (regnum) {
+        case IO_SOUND1CNT_L:
+            break;
+        case IO_SOUND1CNT_H:
+            envelope_written(psg, 0);
+            break;
+        case IO_SOUND1CNT_X:
+            frequency_written(psg, 0, &psg->SOUND1CNT_X);
+            break;
+        case IO_SOUND2CNT_L:
+            envelope_written(psg, 1);
+            break;
+        case IO_SOUND2CNT_H:
+            frequency_written(psg, 1, &psg->SOUND2CNT_H);
+            break;
+        case IO_SOUND3CNT_L:
+            if (!psg->SOUND3CNT_L.dac_enable) {
+                psg->channel[2].enabled = false;
+            }
+            break;
+        case IO_SOUND3CNT_H:
+            psg->channel[2].length = 256 - psg->SOUND3CNT_H.length;
+            break;
+        case IO_SOUND3CNT_X:
+            frequency_written(psg, 2, &psg->SOUND3CNT_X);
+            break;
+        case IO_SOUND4CNT_L:
+            envelope_written(psg, 3);
+            break;
+        case IO_SOUND4CNT_H:
+            psg->channel[3].period = channel_period(psg, 3);
+            if (psg->SOUND4CNT_H.restart) {
+                psg->SOUND4CNT_H.restart = false;
+                trigger(psg, 3);
+            }
+            break;
+        case IO_SOUNDCNT_X:
+            if (!apu->SOUNDCNT_X.master_enable) {
+                // Turning the PSG off clears all of its registers, wave RAM excepted
+                byte wave_ram[2][WAVE_RAM_BANK_SIZE];
+                memcpy(wave_ram, psg->wave_ram, sizeof(wave_ram));
+                word clock = psg->clock;
+                word sequencer_countdown = psg->sequencer_countdown;
+                memset(psg, 0, sizeof(gba_psg_t));
+                memcpy(psg->wave_ram, wave_ram, sizeof(wave_ram));
+                psg->clock = clock;
+                psg->sequencer_countdown = sequencer_countdown;
+                apu->SOUNDCNT_L.raw = 0;
+            }
+            break;
+        default:
+            // Wave RAM, nothing to do
+            break;
+    }
+
+    for (int n = 0; n < PSG_CHANNELS; n++) {
+        update_output(apu, n, psg->clock);
+    }
+}
+
+half* psg_wave_ram_ptr(gba_apu_t* apu, word regnum) {
+    // The CPU sees whichever bank isn't selected for playback
+    int bank = !apu->psg.SOUND3CNT_L.bank;
+    return (half*)&apu->psg.wave_ram[bank][regnum - WAVE_RAM0_L];
+}
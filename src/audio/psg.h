@@ -0,0 +1,147 @@
+#ifndef GBA_PSG_H
+#define GBA_PSG_H
+
+#include <stdbool.h>
+
+#include "../common/util.h"
+
+// The four legacy Game Boy channels. Nothing here is stepped per cycle: each channel knows how many cycles are left
+// until its waveform next changes, and is caught up in one go, only when something needs its output to be current (a
+// sound register access, or the end of an audio frame.) Every edge it produces on the way lands in the blip buffer at
+// the cycle it happened on. Length, envelope and sweep are clocked by the frame sequencer, which is just another
+// countdown checked in the same loop.
+
+#define PSG_CHANNELS 4
+#define PSG_SEQUENCER_CYCLES 32768 // 512Hz
+#define WAVE_RAM_BANK_SIZE 16
+
+typedef union SOUNDCNT_L {
+    struct {
+        unsigned psg_volume_right:3;
+        unsigned:1;
+        unsigned psg_volume_left:3;
+        unsigned:1;
+        unsigned psg_enable_right:4;
+        unsigned psg_enable_left:4;
+    };
+    half raw;
+} SOUNDCNT_L_t;
+
+typedef union SOUNDCNT_X {
+    struct {
+        unsigned psg_on:4; // Read only
+        unsigned:3;
+        bool master_enable:1;
+        unsigned:8;
+    };
+    half raw;
+} SOUNDCNT_X_t;
+
+typedef union SOUND1CNT_L {
+    struct {
+        unsigned sweep_shift:3;
+        bool sweep_decrease:1;
+        unsigned sweep_time:3;
+        unsigned:9;
+    };
+    half raw;
+} SOUND1CNT_L_t;
+
+// SOUND1CNT_H, SOUND2CNT_L, SOUND4CNT_L
+typedef union SOUNDCNT_ENVELOPE {
+    struct {
+        unsigned length:6;
+        unsigned duty:2; // Square channels only
+        unsigned envelope_time:3;
+        bool envelope_increase:1;
+        unsigned envelope_volume:4;
+    };
+    half raw;
+} SOUNDCNT_ENVELOPE_t;
+
+// SOUND1CNT_X, SOUND2CNT_H, SOUND3CNT_X
+typedef union SOUNDCNT_FREQ {
+    struct {
+        unsigned frequency:11;
+        unsigned:3;
+        bool length_enable:1;
+        bool restart:1;
+    };
+    half raw;
+} SOUNDCNT_FREQ_t;
+
+typedef union SOUND3CNT_L {
+    struct {
+        unsigned:5;
+        bool two_banks:1;
+        unsigned bank:1;
+        bool dac_enable:1;
+        unsigned:8;
+    };
+    half raw;
+} SOUND3CNT_L_t;
+
+typedef union SOUND3CNT_H {
+    struct {
+        unsigned length:8;
+        unsigned:5;
+        unsigned volume:2;
+        bool force_volume:1; // 75%
+    };
+    half raw;
+} SOUND3CNT_H_t;
+
+typedef union SOUND4CNT_H {
+    struct {
+        unsigned ratio:3;
+        bool narrow:1; // 7 bit LFSR instead of 15
+        unsigned shift:4;
+        unsigned:6;
+        bool length_enable:1;
+        bool restart:1;
+    };
+    half raw;
+} SOUND4CNT_H_t;
+
+typedef struct psg_channel {
+    bool enabled;
+    word period;    // Cycles between waveform steps
+    word countdown; // Cycles until the next one
+    word position;  // Duty step, wave RAM sample, or LFSR state for noise
+    half length;
+    byte volume;
+    byte envelope_timer;
+} psg_channel_t;
+
+typedef struct gba_psg {
+    SOUND1CNT_L_t SOUND1CNT_L;
+    SOUNDCNT_ENVELOPE_t SOUND1CNT_H;
+    SOUNDCNT_FREQ_t SOUND1CNT_X;
+    SOUNDCNT_ENVELOPE_t SOUND2CNT_L;
+    SOUNDCNT_FREQ_t SOUND2CNT_H;
+    SOUND3CNT_L_t SOUND3CNT_L;
+    SOUND3CNT_H_t SOUND3CNT_H;
+    SOUNDCNT_FREQ_t SOUND3CNT_X;
+    SOUNDCNT_ENVELOPE_t SOUND4CNT_L;
+    SOUND4CNT_H_t SOUND4CNT_H;
+    byte wave_ram[2][WAVE_RAM_BANK_SIZE];
+
+    psg_channel_t channel[PSG_CHANNELS];
+    half sweep_frequency;
+    byte sweep_timer;
+    bool sweep_enabled;
+
+    word clock;                // How far the channels have been run, in the same cycles as the APU's clock
+    word sequencer_countdown;
+    byte sequencer_step;
+} gba_psg_t;
+
+struct gba_apu;
+
+// Runs the channels up to the given cycle of the current audio frame
+void psg_run(struct gba_apu* apu, word until);
+// Applies the side effects of a write to one of the PSG's registers, after the new value has been stored
+void psg_write(struct gba_apu* apu, word regnum);
+half* psg_wave_ram_ptr(struct gba_apu* apu, word regnum);
+
+#endif //GBA_PSG_H
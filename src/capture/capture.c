@@ -0,0 +1,370 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "capture.h"
+#include "../common/log.h"
+#include "../audio/audio.h"
+
+// Frames and samples are handed to the writer thread through two single producer, single consumer rings. The
+// emulation thread owns the write indices and the writer thread owns the read indices, so neither side ever takes a
+// lock. When a ring is full the emulation thread drops what it was about to queue rather than wait on the disk, and
+// the writer fills the gap (by repeating the last frame, or with silence) so the two streams stay the same length.
+
+#define VIDEO_QUEUE_SIZE 8
+#define AUDIO_QUEUE_SIZE 64
+#define AUDIO_BLOCK_SAMPLES 1024
+
+// 16777216 cycles per second / 280896 cycles per frame
+#define CAPTURE_FPS_NUM 16777216
+#define CAPTURE_FPS_DEN 280896
+
+typedef struct video_slot {
+    uint64_t frame;
+    int pitch;
+    pixel_format_t format;
+    byte screen[SCREEN_BUFFER_SIZE];
+} video_slot_t;
+
+typedef struct audio_slot {
+    uint64_t block;
+    int num_samples;
+    float samples[AUDIO_BLOCK_SAMPLES];
+} audio_slot_t;
+
+static bool capturing = false;
+static SDL_Thread* writer_thread = NULL;
+static SDL_sem* work_available = NULL;
+static bool stopping = false;
+
+static FILE* video_file = NULL;
+static FILE* audio_file = NULL;
+
+static video_slot_t* video_queue = NULL;
+static uint64_t video_write_index = 0;
+static uint64_t video_read_index = 0;
+
+static audio_slot_t* audio_queue = NULL;
+static uint64_t audio_write_index = 0;
+static uint64_t audio_read_index = 0;
+
+// Emulation thread side
+static uint64_t frames_captured = 0;
+static uint64_t blocks_captured = 0;
+static uint64_t frames_dropped = 0;
+static uint64_t blocks_dropped = 0;
+static float pending_samples[AUDIO_BLOCK_SAMPLES];
+static int num_pending_samples = 0;
+
+// Writer thread side
+static uint64_t frames_written = 0;
+static uint64_t blocks_written = 0;
+static uint32_t audio_bytes_written = 0;
+static byte* yuv_frame = NULL;
+static bool have_yuv_frame = false;
+
+#define Y_PLANE_SIZE (GBA_SCREEN_X * GBA_SCREEN_Y)
+#define C_PLANE_SIZE ((GBA_SCREEN_X / 2) * (GBA_SCREEN_Y / 2))
+
+INLINE void decode_pixel(const byte* row, int x, pixel_format_t format, int* r, int* g, int* b) {
+    half c;
+    *r = *g = *b = 0;
+    switch (format) {
+        case PIXEL_FORMAT_XRGB8888:
+            *r = row[x * 4 + 1];
+            *g = row[x * 4 + 2];
+            *b = row[x * 4 + 3];
+            break;
+        case PIXEL_FORMAT_RGB565: {
+            memcpy(&c, &row[x * 2], sizeof(half));
+            int r5 = c >> 11;
+            int g6 = (c >> 5) & 0x3F;
+            int b5 = c & 0x1F;
+            *r = (r5 << 3) | (r5 >> 2);
+            *g = (g6 << 2) | (g6 >> 4);
+            *b = (b5 << 3) | (b5 >> 2);
+            break;
+        }
+        case PIXEL_FORMAT_RGB555: {
+            memcpy(&c, &row[x * 2], sizeof(half));
+            int r5 = c & 0x1F;
+            int g5 = (c >> 5) & 0x1F;
+            int b5 = (c >> 10) & 0x1F;
+            *r = FIVEBIT_TO_EIGHTBIT_COLOR(r5);
+            *g = FIVEBIT_TO_EIGHTBIT_COLOR(g5);
+            *b = FIVEBIT_TO_EIGHTBIT_COLOR(b5);
+            break;
+        }
+    }
+}
+
+// BT.601, studio range, with 4:2:0 chroma averaged over each 2x2 block
+static void convert_frame(video_slot_t* slot) {
+    byte* y_plane = yuv_frame;
+    byte* u_plane = yuv_frame + Y_PLANE_SIZE;
+    byte* v_plane = u_plane + C_PLANE_SIZE;
+
+    for (int y = 0; y < GBA_SCREEN_Y; y += 2) {
+        const byte* rows[2] = {&slot->screen[y * slot->pitch], &slot->screen[(y + 1) * slot->pitch]};
+        for (int x = 0; x < GBA_SCREEN_X; x += 2) {
+            int r_sum = 0, g_sum = 0, b_sum = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    int r, g, b;
+                    decode_pixel(rows[dy], x + dx, slot->format, &r, &g, &b);
+                    y_plane[(y + dy) * GBA_SCREEN_X + x + dx] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+                    r_sum += r;
+                    g_sum += g;
+                    b_sum += b;
+                }
+            }
+            int r = r_sum / 4, g = g_sum / 4, b = b_sum / 4;
+            int c = (y / 2) * (GBA_SCREEN_X / 2) + (x / 2);
+            u_plane[c] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            v_plane[c] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+    have_yuv_frame = true;
+}
+
+static void write_yuv_frame() {
+    if (!have_yuv_frame) {
+        // Nothing made it through the queue yet, start out black
+        memset(yuv_frame, 16, Y_PLANE_SIZE);
+        memset(yuv_frame + Y_PLANE_SIZE, 128, 2 * C_PLANE_SIZE);
+        have_yuv_frame = true;
+    }
+    fputs("FRAME\n", video_file);
+    fwrite(yuv_frame, Y_PLANE_SIZE + 2 * C_PLANE_SIZE, 1, video_file);
+    frames_written++;
+}
+
+void capture_convert_samples(const float* samples, int16_t* out, int count) {
+    for (int i = 0; i < count; i++) {
+        float sample = samples ? samples[i] : 0.0f;
+        if (sample > 1.0f) {
+            sample = 1.0f;
+        } else if (sample < -1.0f) {
+            sample = -1.0f;
+        }
+        out[i] = (int16_t)(sample * 32767.0f);
+    }
+}
+
+static void write_samples(const float* samples, int num_samples) {
+    int16_t converted[AUDIO_BLOCK_SAMPLES];
+    capture_convert_samples(samples, converted, num_samples);
+    fwrite(converted, sizeof(int16_t), num_samples, audio_file);
+    audio_bytes_written += num_samples * sizeof(int16_t);
+}
+
+static bool drain_queues() {
+    bool drained_any = false;
+
+    while (video_read_index < __atomic_load_n(&video_write_index, __ATOMIC_ACQUIRE)) {
+        video_slot_t* slot = &video_queue[video_read_index % VIDEO_QUEUE_SIZE];
+        while (frames_written < slot->frame) {
+            write_yuv_frame();
+        }
+        convert_frame(slot);
+        write_yuv_frame();
+        __atomic_store_n(&video_read_index, video_read_index + 1, __ATOMIC_RELEASE);
+        drained_any = true;
+    }
+
+    while (audio_read_index < __atomic_load_n(&audio_write_index, __ATOMIC_ACQUIRE)) {
+        audio_slot_t* slot = &audio_queue[audio_read_index % AUDIO_QUEUE_SIZE];
+        while (blocks_written < slot->block) {
+            write_samples(NULL, AUDIO_BLOCK_SAMPLES);
+            blocks_written++;
+        }
+        write_samples(slot->samples, slot->num_samples);
+        blocks_written++;
+        __atomic_store_n(&audio_read_index, audio_read_index + 1, __ATOMIC_RELEASE);
+        drained_any = true;
+    }
+
+    return drained_any;
+}
+
+static int capture_writer_main(void* data) {
+    while (true) {
+        SDL_SemWaitTimeout(work_available, 100);
+        bool stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        while (drain_queues());
+        if (stop) {
+            return 0;
+        }
+    }
+}
+
+INLINE void write_le(FILE* fp, word value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc((value >> (i * 8)) & 0xFF, fp);
+    }
+}
+
+void capture_write_wav_header(FILE* fp, word data_size) {
+    fseek(fp, 0, SEEK_SET);
+    fputs("RIFF", fp);
+    write_le(fp, 36 + data_size, 4);
+    fputs("WAVEfmt ", fp);
+    write_le(fp, 16, 4);                          // fmt chunk size
+    write_le(fp, 1, 2);                           // PCM
+    write_le(fp, AUDIO_CHANNELS, 2);
+    write_le(fp, AUDIO_SAMPLE_RATE, 4);
+    write_le(fp, AUDIO_SAMPLE_RATE * AUDIO_CHANNELS * sizeof(int16_t), 4);
+    write_le(fp, AUDIO_CHANNELS * sizeof(int16_t), 2); // Block align
+    write_le(fp, 16, 2);                          // Bits per sample
+    fputs("data", fp);
+    write_le(fp, data_size, 4);
+}
+
+static FILE* open_capture_file(const char* prefix, const char* extension) {
+    size_t len = strlen(prefix) + strlen(extension) + 1;
+    char* path = malloc(len);
+    snprintf(path, len, "%s%s", prefix, extension);
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        logfatal("Unable to open %s for capture", path)
+    }
+    loginfo("Capturing to %s", path)
+    free(path);
+    return fp;
+}
+
+void capture_start(const char* prefix) {
+    if (capturing) {
+        return;
+    }
+
+    video_file = open_capture_file(prefix, ".y4m");
+    audio_file = open_capture_file(prefix, ".wav");
+    fprintf(video_file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+            GBA_SCREEN_X, GBA_SCREEN_Y, CAPTURE_FPS_NUM, CAPTURE_FPS_DEN);
+    capture_write_wav_header(audio_file, 0);
+
+    video_queue = malloc(VIDEO_QUEUE_SIZE * sizeof(video_slot_t));
+    audio_queue = malloc(AUDIO_QUEUE_SIZE * sizeof(audio_slot_t));
+    yuv_frame = malloc(Y_PLANE_SIZE + 2 * C_PLANE_SIZE);
+    have_yuv_frame = false;
+
+    video_write_index = video_read_index = 0;
+    audio_write_index = audio_read_index = 0;
+    frames_captured = blocks_captured = 0;
+    frames_dropped = blocks_dropped = 0;
+    frames_written = blocks_written = 0;
+    audio_bytes_written = 0;
+    num_pending_samples = 0;
+    stopping = false;
+
+    work_available = SDL_CreateSemaphore(0);
+    writer_thread = SDL_CreateThread(capture_writer_main, "capture", NULL);
+    if (!writer_thread) {
+        logfatal("Unable to start capture thread: %s", SDL_GetError())
+    }
+    capturing = true;
+}
+
+static void push_audio_block() {
+    uint64_t block = blocks_captured++;
+    if (audio_write_index - __atomic_load_n(&audio_read_index, __ATOMIC_ACQUIRE) >= AUDIO_QUEUE_SIZE) {
+        blocks_dropped++;
+    } else {
+        audio_slot_t* slot = &audio_queue[audio_write_index % AUDIO_QUEUE_SIZE];
+        slot->block = block;
+        slot->num_samples = num_pending_samples;
+        memcpy(slot->samples, pending_samples, num_pending_samples * sizeof(float));
+        __atomic_store_n(&audio_write_index, audio_write_index + 1, __ATOMIC_RELEASE);
+        SDL_SemPost(work_available);
+    }
+    num_pending_samples = 0;
+}
+
+void capture_stop() {
+    if (!capturing) {
+        return;
+    }
+    capturing = false;
+
+    if (num_pending_samples > 0) {
+        push_audio_block();
+    }
+
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    SDL_SemPost(work_available);
+    SDL_WaitThread(writer_thread, NULL);
+    writer_thread = NULL;
+    SDL_DestroySemaphore(work_available);
+    work_available = NULL;
+
+    // Anything dropped after the last queued frame or block still has to be accounted for
+    while (frames_written < frames_captured) {
+        write_yuv_frame();
+    }
+    while (blocks_written < blocks_captured) {
+        write_samples(NULL, AUDIO_BLOCK_SAMPLES);
+        blocks_written++;
+    }
+
+    capture_write_wav_header(audio_file, audio_bytes_written);
+    fclose(video_file);
+    fclose(audio_file);
+    video_file = NULL;
+    audio_file = NULL;
+
+    free(video_queue);
+    free(audio_queue);
+    free(yuv_frame);
+    video_queue = NULL;
+    audio_queue = NULL;
+    yuv_frame = NULL;
+
+    if (frames_dropped || blocks_dropped) {
+        logwarn("Capture fell behind: %lu frames and %lu audio blocks were filled in",
+                (unsigned long)frames_dropped, (unsigned long)blocks_dropped)
+    }
+    loginfo("Captured %lu frames", (unsigned long)frames_written)
+}
+
+bool capture_active() {
+    return capturing;
+}
+
+void capture_frame(const byte* screen, int pitch, pixel_format_t format) {
+    if (!capturing) {
+        return;
+    }
+
+    uint64_t frame = frames_captured++;
+    if (video_write_index - __atomic_load_n(&video_read_index, __ATOMIC_ACQUIRE) >= VIDEO_QUEUE_SIZE) {
+        frames_dropped++;
+        return;
+    }
+
+    video_slot_t* slot = &video_queue[video_write_index % VIDEO_QUEUE_SIZE];
+    slot->frame = frame;
+    slot->pitch = pitch;
+    slot->format = format;
+    memcpy(slot->screen, screen, pitch * GBA_SCREEN_Y);
+    __atomic_store_n(&video_write_index, video_write_index + 1, __ATOMIC_RELEASE);
+    SDL_SemPost(work_available);
+}
+
+void capture_audio_samples(const float* samples, int count) {
+    if (!capturing) {
+        return;
+    }
+
+    while (count > 0) {
+        int space = AUDIO_BLOCK_SAMPLES - num_pending_samples;
+        int n = count < space ? count : space;
+        memcpy(&pending_samples[num_pending_samples], samples, n * sizeof(float));
+        num_pending_samples += n;
+        samples += n;
+        count -= n;
+        if (num_pending_samples == AUDIO_BLOCK_SAMPLES) {
+            push_audio_block();
+        }
+    }
+}
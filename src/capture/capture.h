@@ -0,0 +1,25 @@
+#ifndef GBA_CAPTURE_H
+#define GBA_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "../common/util.h"
+#include "../graphics/ppu.h"
+
+// Records video to <prefix>.y4m and audio to <prefix>.wav. The emulation thread only copies frames and samples into
+// fixed size queues, a writer thread does the conversion and the file IO.
+void capture_start(const char* prefix);
+void capture_stop();
+bool capture_active();
+
+// Once per emulated frame, whether or not it was rendered, so the video stays in step with the audio
+void capture_frame(const byte* screen, int pitch, pixel_format_t format);
+// Interleaved stereo, count is in samples rather than pairs
+void capture_audio_samples(const float* samples, int count);
+
+// Shared with the file audio sink: 16 bit stereo PCM at AUDIO_SAMPLE_RATE. The header is written once up front, and
+// again with the real size when the file is done. A NULL samples converts to silence.
+void capture_write_wav_header(FILE* fp, word data_size);
+void capture_convert_samples(const float* samples, int16_t* out, int count);
+
+#endif //GBA_CAPTURE_H
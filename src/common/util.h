@@ -7,6 +7,7 @@
 #define word uint32_t
 
 #define popcount(x) __builtin_popcountll(x)
+#define ctz(x) __builtin_ctzll(x)
 #define FAKELITTLE_HALF(h) ((((h) >> 8u) & 0xFFu) | (((h) << 8u) & 0xFF00u))
 #define FAKELITTLE_WORD(w) (FAKELITTLE_HALF((w) >> 16u) | (FAKELITTLE_HALF((w) & 0xFFFFu)) << 16u)
 
@@ -1,3 +1,5 @@
+#include <signal.h>
+#include <string.h>
 #include <cflags.h>
 #ifdef MinGW
 #define SDL_MAIN_HANDLED
@@ -8,6 +10,20 @@
 #include "gba_system.h"
 #include "graphics/debug.h"
 #include "graphics/render.h"
+#include "graphics/ppu_worker.h"
+#include "graphics/shm_export.h"
+#include "graphics/frame_pipeline.h"
+#include "capture/capture.h"
+
+// Exit through cleanup() so shared memory gets unlinked and captures get finalized
+void quit_on_signal(int sig) {
+    should_quit = true;
+}
+
+int emulation_thread(void* data) {
+    gba_system_loop();
+    return 0;
+}
 
 void usage(cflags_t* flags) {
     cflags_print_usage(flags,
@@ -20,12 +36,32 @@ int main(int argc, char** argv) {
     cflags_t* flags = cflags_init();
     bool debug = false;
     bool should_skip_bios = false;
+    bool threaded_ppu = false;
+    bool present_thread = false;
+    bool pipeline = false;
+    bool audio_sync = false;
+    const char* audio_sink = NULL;
     const char* bios_file = NULL;
+    const char* pixel_format = NULL;
+    const char* export_shm = NULL;
+    const char* capture_prefix = NULL;
+    const char* filter = NULL;
     int scale = 4;
+    int frameskip = 1;
     cflags_add_bool(flags, 'd', "debug", &debug, "enable debug mode at start");
     cflags_add_string(flags, 'b', "bios", &bios_file, "Alternative BIOS to load");
     cflags_add_bool(flags, 's', "skip-bios", &should_skip_bios, "Skip the bios, start execution at ROM entrypoint");
     cflags_add_int(flags, 'S', "scale", &scale, "Scale the screen (default 4)");
+    cflags_add_string(flags, 'x', "filter", &filter, "Scale on the CPU with this filter: nearest, scale2x, scale3x or xbr");
+    cflags_add_int(flags, 'f', "frameskip", &frameskip, "Only draw one frame out of every N (default 1)");
+    cflags_add_bool(flags, 'T', "threaded-ppu", &threaded_ppu, "Render scanlines on a separate thread");
+    cflags_add_string(flags, 'F', "pixel-format", &pixel_format, "Output pixel format: xrgb8888 (default), rgb565 or rgb555");
+    cflags_add_string(flags, 'E', "export-shm", &export_shm, "Run without a window or audio, publishing frames to this POSIX shared memory name");
+    cflags_add_string(flags, 'c', "capture", &capture_prefix, "Record video and audio to PREFIX.y4m and PREFIX.wav");
+    cflags_add_bool(flags, 'P', "pipeline", &pipeline, "Hand finished frames to capture and shared memory export on a separate thread");
+    cflags_add_bool(flags, 'p', "present-thread", &present_thread, "Present frames from their own thread, so emulation isn't held to vsync");
+    cflags_add_string(flags, 'A', "audio-sink", &audio_sink, "Where audio goes: sdl (default), null, memory, wav:PATH or raw:PATH");
+    cflags_add_bool(flags, 'a', "audio-sync", &audio_sync, "Pace emulation to the audio device instead of vsync");
 
     cflags_flag_t * verbose = cflags_add_bool(flags, 'v', "verbose", NULL, "enables verbose output, repeat up to 4 times for more verbosity");
 
@@ -38,9 +74,81 @@ int main(int argc, char** argv) {
     log_set_verbosity(verbose->count);
 
     set_screen_scale(scale);
+    if (filter) {
+        if (strcmp(filter, "nearest") == 0) {
+            set_scale_filter(SCALE_FILTER_NEAREST);
+        } else if (strcmp(filter, "scale2x") == 0) {
+            set_scale_filter(SCALE_FILTER_SCALE2X);
+        } else if (strcmp(filter, "scale3x") == 0) {
+            set_scale_filter(SCALE_FILTER_SCALE3X);
+        } else if (strcmp(filter, "xbr") == 0) {
+            set_scale_filter(SCALE_FILTER_XBR);
+        } else {
+            logfatal("Unknown filter: %s", filter)
+        }
+    }
+    if (frameskip > 1) {
+        set_render_policy(RENDER_FRAMESKIP, frameskip);
+    }
+    if (audio_sink) {
+        if (strcmp(audio_sink, "sdl") == 0) {
+            set_audio_sink(AUDIO_SINK_SDL, NULL);
+        } else if (strcmp(audio_sink, "null") == 0) {
+            set_audio_sink(AUDIO_SINK_NULL, NULL);
+        } else if (strcmp(audio_sink, "memory") == 0) {
+            set_audio_sink(AUDIO_SINK_MEMORY, NULL);
+        } else if (strncmp(audio_sink, "wav:", 4) == 0) {
+            set_audio_sink(AUDIO_SINK_WAV, audio_sink + 4);
+        } else if (strncmp(audio_sink, "raw:", 4) == 0) {
+            set_audio_sink(AUDIO_SINK_RAW, audio_sink + 4);
+        } else {
+            logfatal("Unknown audio sink: %s", audio_sink)
+        }
+    }
+    if (audio_sync) {
+        // Only the audio device drains the ring in real time. Any other sink would leave nothing pacing emulation.
+        bool device = audio_sink ? strcmp(audio_sink, "sdl") == 0 : export_shm == NULL;
+        if (!device) {
+            logfatal("-a paces emulation to the audio device, so it needs the sdl audio sink")
+        }
+        set_audio_sync(true);
+        set_audio_paced(true);
+    }
+
+
+    // Before the APU comes up, so it knows to generate samples for capture even with the null sink
+    if (capture_prefix) {
+        capture_start(capture_prefix);
+        frame_pipeline_add_consumer(capture_frame);
+    }
+
+    init_gbasystem(flags->argv[0], bios_file, export_shm == NULL);
+
+    if (pixel_format) {
+        if (strcmp(pixel_format, "xrgb8888") == 0) {
+            ppu_set_pixel_format(ppu, PIXEL_FORMAT_XRGB8888);
+        } else if (strcmp(pixel_format, "rgb565") == 0) {
+            ppu_set_pixel_format(ppu, PIXEL_FORMAT_RGB565);
+        } else if (strcmp(pixel_format, "rgb555") == 0) {
+            ppu_set_pixel_format(ppu, PIXEL_FORMAT_RGB555);
+        } else {
+            logfatal("Unknown pixel format: %s", pixel_format)
+        }
+    }
 
+    if (export_shm) {
+        shm_export_start(export_shm, ppu);
+        frame_pipeline_add_consumer(shm_export_frame);
+    }
 
-    init_gbasystem(flags->argv[0], bios_file, true);
+    if (pipeline) {
+        frame_pipeline_start(ppu);
+    }
+
+    if (capture_prefix || export_shm) {
+        signal(SIGINT, quit_on_signal);
+        signal(SIGTERM, quit_on_signal);
+    }
 
     loginfo("ROM loaded: %lu bytes", mem->rom_size)
     if (should_skip_bios) {
@@ -48,13 +156,21 @@ int main(int argc, char** argv) {
         skip_bios(cpu);
     }
 
+    if (threaded_ppu) {
+        ppu_worker_start(ppu);
+    }
+
     loginfo("Beginning CPU loop")
 
     if (debug) {
         set_dbg_window_visibility(true);
     }
 
-    gba_system_loop(cpu, ppu, bus);
+    if (present_thread && !debug && !export_shm) {
+        run_presentation_loop(emulation_thread);
+    } else {
+        gba_system_loop(cpu, ppu, bus);
+    }
 
     cflags_free(flags);
     return 0;
@@ -4,16 +4,21 @@
 #include "mem/gbabus.h"
 #include "mem/gbarom.h"
 #include "mem/gbabios.h"
+#include "mem/backup/backup_writer.h"
 #include "gba_system.h"
+#include "graphics/ppu_worker.h"
+#include "graphics/shm_export.h"
+#include "graphics/frame_pipeline.h"
+#include "graphics/scaler.h"
+#include "capture/capture.h"
 
-int cycles = 0;
 
 arm7tdmi_t* cpu = NULL;
 gba_ppu_t* ppu = NULL;
 gbabus_t* bus = NULL;
 gbamem_t* mem = NULL;
 gba_apu_t* apu = NULL;
-bool should_quit = false;
+_Atomic bool should_quit = false;
 
 #define VISIBLE_CYCLES 960
 #define HBLANK_CYCLES 272
@@ -157,9 +162,7 @@ INLINE int run_system(int for_cycles) {
     while (for_cycles > 0) {
         int ran = inline_gba_cpu_step();
         timer_tick(ran);
-        for (int i = 0; i < ran; i++) {
-            apu_tick(apu);
-        }
+        apu_advance(apu, ran);
         for_cycles -= ran;
     }
     return for_cycles;
@@ -168,11 +171,7 @@ INLINE int run_system(int for_cycles) {
 INLINE void inline_gba_system_step() {
     int this_step_cycles = inline_gba_cpu_step();
     timer_tick(this_step_cycles);
-    cycles += this_step_cycles;
-    while (cycles > 0) {
-        apu_tick(apu);
-        cycles--;
-    }
+    apu_advance(apu, this_step_cycles);
 }
 
 // Non-inlined version of the above
@@ -186,17 +185,17 @@ void persist_backup() {
         mem->backup_dirty = 0;
     } else if (--mem->backup_persist_countdown == 0) {
         if (bus->backup_type != UNKNOWN && mem->backup != NULL) {
-            FILE *fp = fopen(mem->backup_path, "wb");
-            if (fp != NULL) {
-                fwrite(mem->backup, mem->backup_size, 1, fp);
-                fclose(fp);
-            }
-            mem->backup_dirty = false;
+            backup_writer_flush(mem);
         }
     }
 }
 
 void cleanup() {
+    // Anything written since the last debounced flush
+    if (bus->backup_type != UNKNOWN && mem->backup != NULL) {
+        backup_writer_flush(mem);
+    }
+    backup_writer_stop();
     free(mem->backup);
     free((void*)mem->backup_path);
     for (int i = 0; i < 10; i++) {
@@ -207,10 +206,19 @@ void cleanup() {
     free(mem);
     mem = NULL;
 
+    ppu_worker_stop();
+    frame_pipeline_stop();
+    shm_export_stop();
+    capture_stop();
+    scaler_stop();
     free(ppu);
     ppu = NULL;
     free(bus);
     bus = NULL;
+    audio_sink_close(apu->sink);
+    for (int side = 0; side < AUDIO_CHANNELS; side++) {
+        free(apu->blip[side]);
+    }
     free(apu);
     apu = NULL;
     free(cpu);
@@ -234,6 +242,7 @@ void gba_system_loop() {
             ppu_end_hblank(ppu);
         }
         ppu_end_vblank(ppu);
+        apu_end_frame(apu);
         persist_backup();
     }
 
@@ -262,6 +271,10 @@ void save_state(const char* path) {
     header.backup_size = mem->backup_size;
     header.apu_size = sizeof(gba_apu_t);
 
+    // Let the PPU worker finish writing the current frame first
+    ppu_worker_sync();
+    frame_pipeline_sync();
+
     FILE* fp = fopen(path, "wb");
 
     fwrite(&header, sizeof(savestate_header_t), 1, fp);
@@ -304,8 +317,14 @@ void load_state(const char* path) {
 
     cpu->cpu_idle = cpu_idle;
 
-    // Restore PPU. No pointers need to be restored.
+    // Restore PPU. Need to restore the screen pointer, and anything cached from the old VRAM has to go.
+    // The output format is a frontend setting, so that's kept rather than taken from the save.
+    ppu_worker_sync();
+    frame_pipeline_sync();
+    pixel_format_t pixel_format = ppu->pixel_format;
     fread(ppu, header.ppu_size, 1, fp);
+    ppu->screen = ppu->screen_buffers[0];
+    ppu_set_pixel_format(ppu, pixel_format);
 
     // Restore bus. No pointers need to be restored.
     fread(bus, header.bus_size, 1, fp);
@@ -321,7 +340,25 @@ void load_state(const char* path) {
     mem->savestate_path = savestate_path;
     mem->backup = backup;
     fread(mem->backup, header.backup_size, 1, fp);
-
-    // Restore APU. No pointers need to be restored.
+    // The save file has none of this, it all goes out with the next flush
+    memset(mem->backup_dirty_blocks, 0xFF, sizeof(mem->backup_dirty_blocks));
+
+    // Restore APU. Need to restore the sink, which the audio callback or a writer thread may be reading from right now,
+    // and the blip buffers. The output timeline carries on from where it is, stepping over to the loaded level.
+    audio_sink_t* sink = apu->sink;
+    bool generate_samples = apu->generate_samples;
+    blip_buffer_t* blip[AUDIO_CHANNELS];
+    float amplitude[AUDIO_CHANNELS];
+    memcpy(blip, apu->blip, sizeof(blip));
+    memcpy(amplitude, apu->amplitude, sizeof(amplitude));
+    word clock = apu->clock;
     fread(apu, header.apu_size, 1, fp);
+    apu->sink = sink;
+    apu->generate_samples = generate_samples;
+    memcpy(apu->blip, blip, sizeof(blip));
+    apu->clock = clock;
+    apu->psg.clock = clock;
+    for (int side = 0; side < AUDIO_CHANNELS; side++) {
+        blip_add_delta(blip[side], clock, apu->amplitude[side] - amplitude[side]);
+    }
 }
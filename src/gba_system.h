@@ -14,7 +14,8 @@ extern gba_ppu_t* ppu;
 extern gbabus_t* bus;
 extern gbamem_t* mem;
 extern gba_apu_t* apu;
-extern bool should_quit;
+// Set from the presentation thread and signal handlers, read by the emulation thread
+extern _Atomic bool should_quit;
 
 void init_gbasystem(const char* romfile, const char* bios_file, bool enable_frontend);
 void gba_system_step();
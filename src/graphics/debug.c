@@ -664,10 +664,13 @@ void debug_handle_event(SDL_Event* event) {
 
 void copy_texture_line(dbg_layer_t layer) {
     if (layer == OBJ) {
+        gba_color_t backdrop;
+        backdrop.raw = half_from_byte_array(ppu->pram, 0);
         for (int x = 0; x < GBA_SCREEN_X; x++) {
-            dbg_bg_layers[layer][ppu->y][x].r = FIVEBIT_TO_EIGHTBIT_COLOR(ppu->objbuf[x].r);
-            dbg_bg_layers[layer][ppu->y][x].g = FIVEBIT_TO_EIGHTBIT_COLOR(ppu->objbuf[x].g);
-            dbg_bg_layers[layer][ppu->y][x].b = FIVEBIT_TO_EIGHTBIT_COLOR(ppu->objbuf[x].b);
+            gba_color_t color = line_mask_get(ppu->obj_drawn, x) ? ppu->objbuf[x].color : backdrop;
+            dbg_bg_layers[layer][ppu->y][x].r = FIVEBIT_TO_EIGHTBIT_COLOR(color.r);
+            dbg_bg_layers[layer][ppu->y][x].g = FIVEBIT_TO_EIGHTBIT_COLOR(color.g);
+            dbg_bg_layers[layer][ppu->y][x].b = FIVEBIT_TO_EIGHTBIT_COLOR(color.b);
             dbg_bg_layers[layer][ppu->y][x].a = 0xFF;
         }
     } else {
@@ -0,0 +1,115 @@
+#include <string.h>
+#include <SDL.h>
+
+#include "frame_pipeline.h"
+#include "../common/log.h"
+
+// Frame N is consumed from one of ppu->screen_buffers while frame N+1 is drawn into the other. Line skipping needs the
+// buffer being drawn to start out holding the previous frame, so before each swap the rows that changed in the
+// finished frame are copied across. That's only the rows that changed, and usually far less than a whole frame.
+
+static frame_consumer_t consumers[MAX_FRAME_CONSUMERS];
+static int num_consumers = 0;
+
+static SDL_Thread* pipeline_thread = NULL;
+static SDL_sem* frame_queued = NULL;
+static SDL_sem* frame_consumed = NULL;
+static bool quitting = false;
+
+// Only written while the pipeline thread is idle
+static const byte* queued_screen = NULL;
+static int queued_pitch = 0;
+static pixel_format_t queued_format = PIXEL_FORMAT_XRGB8888;
+
+void frame_pipeline_add_consumer(frame_consumer_t consumer) {
+    if (num_consumers == MAX_FRAME_CONSUMERS) {
+        logfatal("Too many frame consumers")
+    }
+    consumers[num_consumers++] = consumer;
+}
+
+INLINE void run_consumers(const byte* screen, int pitch, pixel_format_t format) {
+    for (int i = 0; i < num_consumers; i++) {
+        consumers[i](screen, pitch, format);
+    }
+}
+
+static int frame_pipeline_main(void* data) {
+    while (true) {
+        SDL_SemWait(frame_queued);
+        if (quitting) {
+            return 0;
+        }
+        run_consumers(queued_screen, queued_pitch, queued_format);
+        SDL_SemPost(frame_consumed);
+    }
+}
+
+void frame_pipeline_start(gba_ppu_t* ppu) {
+    if (pipeline_thread) {
+        return;
+    }
+
+    quitting = false;
+    frame_queued = SDL_CreateSemaphore(0);
+    // Nothing has been handed over yet, so the first submit doesn't have anything to wait for
+    frame_consumed = SDL_CreateSemaphore(1);
+
+    pipeline_thread = SDL_CreateThread(frame_pipeline_main, "frames", NULL);
+    if (!pipeline_thread) {
+        logfatal("Unable to start frame pipeline thread: %s", SDL_GetError())
+    }
+}
+
+void frame_pipeline_stop() {
+    if (!pipeline_thread) {
+        return;
+    }
+
+    frame_pipeline_sync();
+    quitting = true;
+    SDL_SemPost(frame_queued);
+    SDL_WaitThread(pipeline_thread, NULL);
+    pipeline_thread = NULL;
+
+    SDL_DestroySemaphore(frame_queued);
+    SDL_DestroySemaphore(frame_consumed);
+}
+
+void frame_pipeline_submit(gba_ppu_t* ppu) {
+    if (!pipeline_thread) {
+        run_consumers(ppu->screen, ppu->screen_pitch, ppu->pixel_format);
+        return;
+    }
+
+    byte* finished = ppu->screen;
+    byte* next = finished == ppu->screen_buffers[0] ? ppu->screen_buffers[1] : ppu->screen_buffers[0];
+
+    // next holds the frame before this one, and can't be touched until the consumers are done with it
+    SDL_SemWait(frame_consumed);
+
+    for (int i = 0; i < SCREEN_ROW_MASK_WORDS; i++) {
+        uint64_t rows = ppu->dirty_rows[i];
+        while (rows) {
+            int y = i * 64 + ctz(rows);
+            memcpy(&next[y * ppu->screen_pitch], &finished[y * ppu->screen_pitch], ppu->screen_pitch);
+            rows &= rows - 1;
+        }
+    }
+
+    queued_screen = finished;
+    queued_pitch = ppu->screen_pitch;
+    queued_format = ppu->pixel_format;
+    SDL_SemPost(frame_queued);
+
+    ppu->screen = next;
+}
+
+void frame_pipeline_sync() {
+    if (!pipeline_thread) {
+        return;
+    }
+
+    SDL_SemWait(frame_consumed);
+    SDL_SemPost(frame_consumed);
+}
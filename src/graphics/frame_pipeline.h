@@ -0,0 +1,21 @@
+#ifndef GBA_FRAME_PIPELINE_H
+#define GBA_FRAME_PIPELINE_H
+
+#include "ppu.h"
+
+#define MAX_FRAME_CONSUMERS 4
+
+// Gets every finished frame. The buffer stays valid, and unchanged, until the consumer returns.
+typedef void (*frame_consumer_t)(const byte* screen, int pitch, pixel_format_t format);
+
+void frame_pipeline_add_consumer(frame_consumer_t consumer);
+// Without a pipeline thread, consumers run inline at VBlank
+void frame_pipeline_start(gba_ppu_t* ppu);
+void frame_pipeline_stop();
+// Called at VBlank with the finished frame in ppu->screen. Waits for the consumers to be done with the frame before
+// it, hands them this one, and points ppu->screen at the other buffer so the next frame can start right away.
+void frame_pipeline_submit(gba_ppu_t* ppu);
+// Blocks until the consumers are done with every submitted frame
+void frame_pipeline_sync();
+
+#endif //GBA_FRAME_PIPELINE_H
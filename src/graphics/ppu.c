@@ -4,6 +4,8 @@
 #include "../mem/gbabus.h"
 #include "render.h"
 #include "debug.h"
+#include "ppu_worker.h"
+#include "frame_pipeline.h"
 #include "../mem/dma.h"
 
 
@@ -14,13 +16,93 @@ typedef struct obj_affine {
     int16_t pd;
 } obj_affine_t;
 
-INLINE void clear_obj(gba_ppu_t* ppu) {
-    for (int x = 0; x < GBA_SCREEN_X; x++) {
-        ppu->obj_priorities[x] = 0;
-        ppu->obj_window[x] = false;
-        ppu->objbuf[x].raw = half_from_byte_array(ppu->pram, 0);
-        ppu->objbuf[x].transparent = true;
+// Tiles decoded to one palette index per pixel, indexed by VRAM_TILE_SIZE slot. 8bpp tiles cover two slots, but
+// OBJ tile numbers are in 32 byte units so they can start on any slot. Horizontally flipped copies are only decoded
+// when something actually asks for them, vertical flips just read the rows backwards.
+static byte tile_cache[2][2][VRAM_NUM_TILES][64]; // [is_256color][hflip][slot][pixel]
+static byte tile_cache_valid[2][VRAM_NUM_TILES];  // [is_256color][slot], bit n set means the hflip == n copy is decoded
+static const byte blank_tile[64];
+
+// Last frame's rows stay in ppu->screen, so a line whose inputs all match what its row was drawn from is left alone
+typedef struct line_signature {
+    bool valid;
+    byte registers[PPU_RENDER_REGISTERS_SIZE];
+    word vram_generation[VRAM_NUM_REGIONS]; // Left at 0 for regions the line doesn't read
+    word pram_generation;
+    word oam_generation;
+} line_signature_t;
+
+static line_signature_t line_signatures[GBA_SCREEN_Y];
+
+void ppu_invalidate_caches(gba_ppu_t* ppu) {
+    memset(ppu->vram_dirty, 0xFF, sizeof(ppu->vram_dirty));
+    ppu->pram_dirty = true;
+    ppu->oam_dirty = true;
+    memset(line_signatures, 0, sizeof(line_signatures));
+    memset(ppu->dirty_rows, 0xFF, sizeof(ppu->dirty_rows));
+}
+
+INLINE void refresh_tile_cache(gba_ppu_t* ppu) {
+    for (int i = 0; i < VRAM_NUM_TILES / 64; i++) {
+        uint64_t dirty = ppu->vram_dirty[i];
+        ppu->vram_dirty[i] = 0;
+        while (dirty != 0) {
+            int slot = i * 64 + ctz(dirty);
+            dirty &= dirty - 1;
+            tile_cache_valid[0][slot] = 0;
+            tile_cache_valid[1][slot] = 0;
+            if (slot > 0) {
+                // An 8bpp tile starting in the previous slot overlaps this one
+                tile_cache_valid[1][slot - 1] = 0;
+            }
+        }
+    }
+}
+
+void decode_tile(gba_ppu_t* ppu, int slot, bool is_256color, bool hflip, byte* out) {
+    word tile_address = slot * VRAM_TILE_SIZE;
+    for (int tile_y = 0; tile_y < 8; tile_y++) {
+        for (int tile_x = 0; tile_x < 8; tile_x++) {
+            int in_tile_offset = tile_x + tile_y * 8;
+            byte tile;
+            if (is_256color) {
+                word address = tile_address + in_tile_offset;
+                tile = address < VRAM_SIZE ? ppu->vram[address] : 0;
+            } else {
+                tile = ppu->vram[tile_address + in_tile_offset / 2];
+                tile >>= (in_tile_offset % 2) * 4;
+                tile &= 0xF;
+            }
+            out[tile_y * 8 + (hflip ? 7 - tile_x : tile_x)] = tile;
+        }
+    }
+}
+
+INLINE const byte* get_tile(gba_ppu_t* ppu, word tile_address, bool is_256color, bool hflip) {
+    int slot = tile_address / VRAM_TILE_SIZE;
+    if (slot >= VRAM_NUM_TILES) {
+        return blank_tile;
     }
+    byte* tile = tile_cache[is_256color][hflip][slot];
+    byte variant = 1 << hflip;
+    if ((tile_cache_valid[is_256color][slot] & variant) == 0) {
+        decode_tile(ppu, slot, is_256color, hflip, tile);
+        tile_cache_valid[is_256color][slot] |= variant;
+    }
+    return tile;
+}
+
+INLINE void clear_obj(gba_ppu_t* ppu) {
+    memset(ppu->obj_drawn, 0, sizeof(line_mask_t));
+    memset(ppu->obj_alpha, 0, sizeof(line_mask_t));
+    memset(ppu->obj_window, 0, sizeof(line_mask_t));
+}
+
+void ppu_set_pixel_format(gba_ppu_t* ppu, pixel_format_t format) {
+    ppu->pixel_format = format;
+    ppu->screen_pitch = GBA_SCREEN_X * pixel_format_size(format);
+    memset(ppu->screen_buffers, 0, sizeof(ppu->screen_buffers));
+    ppu_invalidate_caches(ppu);
 }
 
 gba_ppu_t* init_ppu(bool enable_graphics) {
@@ -30,6 +112,8 @@ gba_ppu_t* init_ppu(bool enable_graphics) {
     memset(ppu, 0, sizeof(gba_ppu_t));
 
     ppu->enable_graphics = enable_graphics;
+    ppu->screen = ppu->screen_buffers[0];
+    ppu_set_pixel_format(ppu, PIXEL_FORMAT_XRGB8888);
 
     for (int x = 0; x < GBA_SCREEN_X; x++) {
         ppu->bgbuf[0][x].transparent = true;
@@ -68,7 +152,7 @@ INLINE bool is_win1(gba_ppu_t* ppu, int x, int y) {
 INLINE bool should_render_pixel_window(gba_ppu_t* ppu, int x, int y, bool win0in, bool win1in, bool winout, bool objin) {
     bool is_win0in = is_win0(ppu, x, y);
     bool is_win1in = is_win1(ppu, x, y);
-    bool is_winobj = ppu->obj_window[x];
+    bool is_winobj = line_mask_get(ppu->obj_window, x);
     bool is_winout = !(is_win0in || is_win1in);
 
     bool win0_display = ppu->DISPCNT.window0_display;
@@ -116,6 +200,104 @@ int sprite_widths[3][4] = {
 #define OBJ_AFF_MODE_HIDE   0b10
 #define OBJ_AFF_MODE_DOUBLE 0b11
 
+INLINE int div_floor(int a, int b) {
+    int q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) {
+        q--;
+    }
+    return q;
+}
+
+INLINE int div_ceil(int a, int b) {
+    return -div_floor(-a, b);
+}
+
+// Narrows [*start, *end) down to the pixels where origin + step * x lands in [0, limit)
+INLINE void clip_affine_span(int32_t origin, int32_t step, int32_t limit, int* start, int* end) {
+    int lo;
+    int hi; // inclusive
+    if (step == 0) {
+        if (origin < 0 || origin >= limit) {
+            *start = 0;
+            *end = 0;
+        }
+        return;
+    } else if (step > 0) {
+        lo = div_ceil(-origin, step);
+        hi = div_floor(limit - 1 - origin, step);
+    } else {
+        lo = div_ceil(limit - 1 - origin, step);
+        hi = div_floor(-origin, step);
+    }
+
+    if (lo > *start) {
+        *start = lo;
+    }
+    if (hi + 1 < *end) {
+        *end = hi + 1;
+    }
+    if (*end <= *start) {
+        *start = 0;
+        *end = 0;
+    }
+}
+
+// Draws one OBJ pixel from texel (sprite_x, sprite_y) of the sprite, unless a higher priority sprite is already there
+INLINE void render_obj_pixel(gba_ppu_t* ppu, obj_attr0_t attr0, obj_attr2_t attr2, int tiles_wide, int screen_x, int sprite_x, int sprite_y) {
+    // Only draw if we've never drawn anything there before. Lower indices have higher priority
+    // and that's the order we're drawing them here.
+    if (line_mask_get(ppu->obj_drawn, screen_x) && attr2.priority >= ppu->objbuf[screen_x].priority) {
+        return;
+    }
+
+    int y_tid_offset;
+    int sprite_tile_y = sprite_y / 8;
+    if (ppu->DISPCNT.obj_character_vram_mapping) { // 1D
+        // Tiles are twice as wide in 256 color mode
+        y_tid_offset = tiles_wide * (sprite_tile_y << attr0.is_256color);
+    } else { // 2D
+        y_tid_offset = 32 * sprite_tile_y;
+    }
+    // After adding this offset, we won't need to worry about 1D vs 2D,
+    // because in either case they'll be right next to each other in memory.
+    int tid = attr2.tid + y_tid_offset;
+
+    // Tiles are twice as wide in 256 color mode
+    int x_tid_offset = (sprite_x / 8) << attr0.is_256color;
+    int tid_offset_by_x = tid + x_tid_offset;
+    word tile_address = 0x10000 + tid_offset_by_x * OBJ_TILE_SIZE;
+
+    int in_tile_x = sprite_x % 8;
+    int in_tile_y = sprite_y % 8;
+
+    byte tile = get_tile(ppu, tile_address, attr0.is_256color, false)[in_tile_x + in_tile_y * 8];
+
+    if (tile != 0) {
+
+        word palette_address = 0x200; // OBJ palette base
+        if (attr0.is_256color) {
+            palette_address += 2 * tile;
+        } else {
+            palette_address += (0x20 * attr2.pb + 2 * tile);
+        }
+        if (attr0.graphics_mode == OBJ_MODE_OBJWIN) {
+            line_mask_set(ppu->obj_window, screen_x);
+        } else {
+            if (should_render_pixel_window(ppu, screen_x, ppu->y, ppu->WININ.win0_obj_enable, ppu->WININ.win1_obj_enable, ppu->WINOUT.outside_obj_enable, ppu->WINOUT.obj_obj_enable)) {
+                uint64_t bit = 1ull << (screen_x % 64);
+                ppu->obj_drawn[screen_x / 64] |= bit;
+                if (attr0.graphics_mode == OBJ_MODE_ALPHA) {
+                    ppu->obj_alpha[screen_x / 64] |= bit;
+                } else {
+                    ppu->obj_alpha[screen_x / 64] &= ~bit;
+                }
+                ppu->objbuf[screen_x].priority = attr2.priority;
+                ppu->objbuf[screen_x].color.raw = half_from_byte_array(ppu->pram, palette_address) & 0x7FFF;
+            }
+        }
+    }
+}
+
 void render_obj(gba_ppu_t* ppu) {
     obj_attr0_t attr0;
     obj_attr1_t attr1;
@@ -125,6 +307,9 @@ void render_obj(gba_ppu_t* ppu) {
 
     for (int sprite = 0; sprite < 128; sprite++) {
         attr0.raw = half_from_byte_array(ppu->oam, (sprite * 8) + 0);
+        if (attr0.affine_object_mode == OBJ_AFF_MODE_HIDE) { // Disabled
+            continue;
+        }
         attr1.raw = half_from_byte_array(ppu->oam, (sprite * 8) + 2);
         attr2.raw = half_from_byte_array(ppu->oam, (sprite * 8) + 4);
 
@@ -153,181 +338,98 @@ void render_obj(gba_ppu_t* ppu) {
             adjusted_y -= 256;
         }
 
-        int sprite_y = ppu->y - adjusted_y;
-        if (!is_affine && attr1.vflip) {
-            sprite_y = height - sprite_y - 1;
-        }
-
         int screen_min_y = adjusted_y;
         int screen_max_y = adjusted_y + height;
+        if (is_double_affine) { // double rendering area
+            screen_min_y -= hheight;
+            screen_max_y += hheight;
+        }
 
-        int screen_min_x = adjusted_x;
-        int screen_max_x = adjusted_x + width;
+        if (ppu->y < screen_min_y || ppu->y >= screen_max_y) {
+            continue;
+        }
 
+        int sprite_y = ppu->y - adjusted_y;
 
-        obj_affine_t affine;
         if (is_affine) {
+            obj_affine_t affine;
             affine.pa = half_from_byte_array(ppu->oam, attr1.affine_index * 32 + 6);
             affine.pb = half_from_byte_array(ppu->oam, attr1.affine_index * 32 + 14);
             affine.pc = half_from_byte_array(ppu->oam, attr1.affine_index * 32 + 22);
             affine.pd = half_from_byte_array(ppu->oam, attr1.affine_index * 32 + 30);
-            if (is_double_affine) { // double rendering area
-                screen_min_y -= hheight;
-                screen_max_y += hheight;
-
-                screen_min_x -= hwidth;
-                screen_max_x += hwidth;
 
-                screen_min_x -= (width / 2);
-                if (screen_min_x < 0) {
-                    screen_min_x = 0;
-                }
-                screen_max_x += (width / 2);
-                if (screen_max_x < GBA_SCREEN_X) {
-                    screen_max_x = GBA_SCREEN_X;
-                }
+            // The texel for each pixel of the bounding box is a fixed step from the one before it, so the span that
+            // lands inside the sprite's texture (and on screen) can be worked out before drawing anything
+            int sprite_x_start = is_double_affine ? -hwidth : 0;
+            int first_screen_x = adjusted_x + sprite_x_start;
+            int start = first_screen_x < 0 ? -first_screen_x : 0;
+            int end = (is_double_affine ? 2 * width : width);
+            if (first_screen_x + end > GBA_SCREEN_X) {
+                end = GBA_SCREEN_X - first_screen_x;
+            }
+            if (end <= start) {
+                continue;
             }
 
+            // 8.8 texel coordinates of the bounding box's first pixel, offset so the texture starts at 0
+            int32_t tex_x = affine.pa * (sprite_x_start - hwidth) + affine.pb * (sprite_y - hheight) + (hwidth << 8);
+            int32_t tex_y = affine.pc * (sprite_x_start - hwidth) + affine.pd * (sprite_y - hheight) + (hheight << 8);
+            clip_affine_span(tex_x, affine.pa, width << 8, &start, &end);
+            clip_affine_span(tex_y, affine.pc, height << 8, &start, &end);
+
+            tex_x += affine.pa * start;
+            tex_y += affine.pc * start;
+            for (int i = start; i < end; i++) {
+                render_obj_pixel(ppu, attr0, attr2, tiles_wide, first_screen_x + i, tex_x >> 8, tex_y >> 8);
+                tex_x += affine.pa;
+                tex_y += affine.pc;
+            }
         } else {
-            // Set to identity matrix
-            affine.pa = 0xFF;
-            affine.pb = 0x00;
-            affine.pc = 0x00;
-            affine.pd = 0xFF;
-        }
-
-        if (ppu->y >= screen_min_y && ppu->y < screen_max_y) { // If the sprite is visible, we should draw it.
-            if (attr0.affine_object_mode != OBJ_AFF_MODE_HIDE) { // Not disabled
-                int sprite_x_start = is_double_affine ? -hwidth : 0;
-                int sprite_x_end   = is_double_affine ? width + hwidth : width;
-                for (int sprite_x = sprite_x_start; sprite_x < sprite_x_end; sprite_x++) {
-                    int adjusted_sprite_x = sprite_x;
-                    int adjusted_sprite_y = sprite_y;
-
-                    if (is_affine) {
-                        adjusted_sprite_x = affine.pa * (sprite_x - hwidth) + affine.pb * (sprite_y - hheight);
-                        adjusted_sprite_x >>= 8;
-                        adjusted_sprite_x += hwidth;
-
-                        if (adjusted_sprite_x >= width || adjusted_sprite_x < 0) {
-                            continue;
-                        }
-
-                        adjusted_sprite_y = affine.pc * (sprite_x - hwidth) + affine.pd * (sprite_y - hheight);
-                        adjusted_sprite_y >>= 8;
-                        adjusted_sprite_y += hheight;
-
-                        if (adjusted_sprite_y >= height || adjusted_sprite_y < 0) {
-                            continue;
-                        }
-
-                    } else if (attr1.hflip) {
-                        adjusted_sprite_x = width - sprite_x - 1;
-                    }
-
-                    int y_tid_offset;
-                    int sprite_tile_y = adjusted_sprite_y / 8;
-                    if (ppu->DISPCNT.obj_character_vram_mapping) { // 1D
-                        // Tiles are twice as wide in 256 color mode
-                        y_tid_offset = tiles_wide * (sprite_tile_y << attr0.is_256color);
-                    } else { // 2D
-                        y_tid_offset = 32 * sprite_tile_y;
-                    }
-                    // After adding this offset, we won't need to worry about 1D vs 2D,
-                    // because in either case they'll be right next to each other in memory.
-                    int tid = attr2.tid + y_tid_offset;
-
-                    // Don't use the adjusted X or Y here. There'd be no point in transforming the sprite, otherwise.
-                    int screen_x = sprite_x + adjusted_x;
-                    // Only draw if we've never drawn anything there before. Lower indices have higher priority
-                    // and that's the order we're drawing them here.
-                    if (screen_x < GBA_SCREEN_X && screen_x >= 0 && screen_x >= screen_min_x && screen_x < screen_max_x && (ppu->objbuf[screen_x].transparent || attr2.priority < ppu->obj_priorities[screen_x])) {
-                        // Tiles are twice as wide in 256 color mode
-                        int x_tid_offset = (adjusted_sprite_x / 8) << attr0.is_256color;
-                        int tid_offset_by_x = tid + x_tid_offset;
-                        word tile_address = 0x10000 + tid_offset_by_x * OBJ_TILE_SIZE;
-
-                        int in_tile_x = adjusted_sprite_x % 8;
-                        int in_tile_y = adjusted_sprite_y % 8;
-
-                        int in_tile_offset = in_tile_x + in_tile_y * 8;
-                        tile_address += in_tile_offset >> (!attr0.is_256color);
-
-                        byte tile = ppu->vram[tile_address];
-                        if (!attr0.is_256color) {
-                            tile >>= (in_tile_offset % 2) * 4;
-                            tile &= 0xF;
-                        }
+            if (attr1.vflip) {
+                sprite_y = height - sprite_y - 1;
+            }
 
-                        if (tile != 0) {
-
-                            word palette_address = 0x200; // OBJ palette base
-                            if (attr0.is_256color) {
-                                palette_address += 2 * tile;
-                            } else {
-                                palette_address += (0x20 * attr2.pb + 2 * tile);
-                            }
-                            if (attr0.graphics_mode == OBJ_MODE_OBJWIN) {
-                                ppu->obj_window[screen_x] = true;
-                            } else {
-                                if (should_render_pixel_window(ppu, screen_x, ppu->y, ppu->WININ.win0_obj_enable, ppu->WININ.win1_obj_enable, ppu->WINOUT.outside_obj_enable, ppu->WINOUT.obj_obj_enable)) {
-                                    ppu->obj_priorities[screen_x] = attr2.priority;
-                                    ppu->obj_alpha[screen_x] = attr0.graphics_mode == OBJ_MODE_ALPHA;
-                                    ppu->objbuf[screen_x].raw = half_from_byte_array(ppu->pram, palette_address);
-                                    ppu->objbuf[screen_x].transparent = false;
-                                }
-                            }
-                        }
-                    }
-                }
+            int start = adjusted_x < 0 ? -adjusted_x : 0;
+            int end = adjusted_x + width > GBA_SCREEN_X ? GBA_SCREEN_X - adjusted_x : width;
+            for (int sprite_x = start; sprite_x < end; sprite_x++) {
+                // Don't use the flipped X here. There'd be no point in flipping the sprite, otherwise.
+                int texel_x = attr1.hflip ? width - sprite_x - 1 : sprite_x;
+                render_obj_pixel(ppu, attr0, attr2, tiles_wide, adjusted_x + sprite_x, texel_x, sprite_y);
             }
         }
     }
 }
 
-INLINE void render_tile(gba_ppu_t* ppu, int tid, int pb, gba_color_t (*line)[GBA_SCREEN_X], int screen_x, bool is_256color, word character_base_addr, int tile_x, int tile_y) {
-    int in_tile_offset_divisor = is_256color ? 1 : 2;
-    int tile_size = is_256color ? 0x40 : 0x20;
-    int in_tile_offset = tile_x + tile_y * 8;
-    word tile_address = character_base_addr + tid * tile_size;
-    tile_address += in_tile_offset / in_tile_offset_divisor;
-
-    byte tile = ppu->vram[tile_address];
-
-    if (!is_256color) {
-        tile >>= (in_tile_offset % 2) * 4;
-        tile &= 0xF;
-    }
-
+INLINE void render_tile_pixel(gba_ppu_t* ppu, gba_color_t* pixel, byte tile, int pb, bool is_256color) {
     word palette_address = is_256color ? 2 * tile : (0x20 * pb + 2 * tile);
-    (*line)[screen_x].raw = half_from_byte_array(ppu->pram, palette_address);
-    (*line)[screen_x].transparent = tile == 0; // This color should only be drawn if we need transparency
+    pixel->raw = half_from_byte_array(ppu->pram, palette_address);
+    pixel->transparent = tile == 0; // This color should only be drawn if we need transparency
 }
 
-INLINE void render_screenentry(gba_ppu_t* ppu, gba_color_t (*line)[GBA_SCREEN_X], int screen_x, reg_se_t se, bool is_256color, word character_base_addr, int tilemap_x, int tilemap_y) {
-    // Find the tile
-    int tile_x = tilemap_x % 8;
-    if (se.hflip) {
-        tile_x = 7 - tile_x;
-    }
-    int tile_y = tilemap_y % 8;
-    if (se.vflip) {
-        tile_y = 7 - tile_y;
-    }
-
-    render_tile(ppu, se.tid, se.pb, line, screen_x, is_256color, character_base_addr, tile_x, tile_y);
+INLINE void render_tile(gba_ppu_t* ppu, int tid, int pb, gba_color_t (*line)[GBA_SCREEN_X], int screen_x, bool is_256color, word character_base_addr, int tile_x, int tile_y) {
+    int tile_size = is_256color ? 0x40 : 0x20;
+    const byte* tile = get_tile(ppu, character_base_addr + tid * tile_size, is_256color, false);
+    render_tile_pixel(ppu, &(*line)[screen_x], tile[tile_x + tile_y * 8], pb, is_256color);
 }
 
-
 INLINE void render_bg_regular(gba_ppu_t* ppu, gba_color_t (*line)[GBA_SCREEN_X], BGCNT_t* bgcnt, int hofs, int vofs, bool win0in, bool win1in, bool winout, bool objin) {
     // Tileset (like pattern tables in the NES)
     word character_base_addr = bgcnt->character_base_block * CHARBLOCK_SIZE;
     // Tile map (like nametables in the NES)
     word screen_base_addr = bgcnt->screen_base_block * SCREENBLOCK_SIZE;
+    int tile_size = bgcnt->is_256color ? 0x40 : 0x20;
+
+    int bg_y = (ppu->y + vofs) % 512;
+    int tilemap_y = bg_y % 256;
 
     reg_se_t se;
+    const byte* tile_row = NULL;
     for (int x = 0; x < GBA_SCREEN_X; x++) {
-        if (should_render_pixel_window(ppu, x, ppu->y, win0in, win1in, winout, objin)) {
+        int bg_x = (x + hofs) % 512;
+        int tilemap_x = bg_x % 256;
+
+        // Only look up the screen entry and tile when we cross into a new tile
+        if (tile_row == NULL || tilemap_x % 8 == 0) {
             int screenblock_number;
             switch (bgcnt->screen_size) {
                 case 0:
@@ -336,29 +438,35 @@ INLINE void render_bg_regular(gba_ppu_t* ppu, gba_color_t (*line)[GBA_SCREEN_X],
                     break;
                 case 1:
                     // 0 1
-                    screenblock_number = ((x + hofs) % 512) > 255 ? 1 : 0;
+                    screenblock_number = bg_x > 255 ? 1 : 0;
                     break;
                 case 2:
                     // 0
                     // 1
-                    screenblock_number = ((ppu->y + vofs) % 512) > 255 ? 1 : 0;
+                    screenblock_number = bg_y > 255 ? 1 : 0;
                     break;
                 case 3:
                     // 0 1
                     // 2 3
-                    screenblock_number = ((x + hofs) % 512) > 255 ? 1 : 0;
-                    screenblock_number += ((ppu->y + vofs) % 512) > 255 ? 2 : 0;
+                    screenblock_number = bg_x > 255 ? 1 : 0;
+                    screenblock_number += bg_y > 255 ? 2 : 0;
                     break;
                 default:
                     logfatal("Unimplemented screen size: %d", bgcnt->screen_size);
 
             }
-            int tilemap_x = (x + hofs) % 256;
-            int tilemap_y = (ppu->y + vofs) % 256;
-
             int se_number = (tilemap_x / 8) + (tilemap_y / 8) * 32;
             se.raw = half_from_byte_array(ppu->vram, (screen_base_addr + screenblock_number * SCREENBLOCK_SIZE + se_number * 2));
-            render_screenentry(ppu, line, x, se, bgcnt->is_256color, character_base_addr, tilemap_x, tilemap_y);
+
+            int tile_y = tilemap_y % 8;
+            if (se.vflip) {
+                tile_y = 7 - tile_y;
+            }
+            tile_row = get_tile(ppu, character_base_addr + se.tid * tile_size, bgcnt->is_256color, se.hflip) + tile_y * 8;
+        }
+
+        if (should_render_pixel_window(ppu, x, ppu->y, win0in, win1in, winout, objin)) {
+            render_tile_pixel(ppu, &(*line)[x], tile_row[tilemap_x % 8], se.pb, bgcnt->is_256color);
         } else {
             (*line)[x].raw = half_from_byte_array(ppu->pram, 0);
             (*line)[x].transparent = true;
@@ -366,56 +474,76 @@ INLINE void render_bg_regular(gba_ppu_t* ppu, gba_color_t (*line)[GBA_SCREEN_X],
     }
 }
 
+// Pixels are fetched this many at a time, first all of the coordinates and tile bytes, then the palette lookups
+#define AFFINE_CHUNK 8
+
 void render_bg_affine(gba_ppu_t* ppu, gba_color_t (*line)[GBA_SCREEN_X], BGCNT_t* bgcnt,
                       bool win0in, bool win1in, bool winout, bool objin,
                       bg_referencepoint_container_t* x, bg_referencepoint_container_t* y,
                       bg_rotation_scaling_t* pa, bg_rotation_scaling_t* pb, bg_rotation_scaling_t* pc, bg_rotation_scaling_t* pd) {
     // Tileset (like pattern tables in the NES)
-    word character_base_addr = bgcnt->character_base_block * CHARBLOCK_SIZE;
+    const byte* character_base = &ppu->vram[bgcnt->character_base_block * CHARBLOCK_SIZE];
     // Tile map (like nametables in the NES)
-    word screen_base_addr = bgcnt->screen_base_block * SCREENBLOCK_SIZE;
+    const byte* screen_base = &ppu->vram[bgcnt->screen_base_block * SCREENBLOCK_SIZE];
+
+    // Affine backgrounds are square, 128 << screen_size pixels on a side, so 16 << screen_size tiles
+    int bg_size = 128 << bgcnt->screen_size;
+    int map_shift = 4 + bgcnt->screen_size;
+    int32_t mask = bg_size - 1;
+
+    // Both coordinates are 24.8 fixed point and step by PA/PC for every pixel to the right
+    int32_t ref_x = x->current.sraw;
+    int32_t ref_y = y->current.sraw;
+    int32_t dx = pa->sraw;
+    int32_t dy = pc->sraw;
+
+    // Without wraparound everything outside the background is transparent, so only the span in between is fetched
+    int start = 0;
+    int end = GBA_SCREEN_X;
+    if (!bgcnt->wraparound) {
+        clip_affine_span(ref_x, dx, bg_size << 8, &start, &end);
+        clip_affine_span(ref_y, dy, bg_size << 8, &start, &end);
+    }
 
-    int bg_width;
-    int bg_height;
-    switch (bgcnt->screen_size) {
-        case 0:
-            bg_width = 128;
-            bg_height = 128;
-            break;
-        case 1:
-            bg_width = 256;
-            bg_height = 256;
-            break;
-        case 2:
-            bg_width = 512;
-            bg_height = 512;
-            break;
-        case 3:
-            bg_width = 1024;
-            bg_height = 1024;
-            break;
-        default:
-            logfatal("Unimplemented screen size: %d", bgcnt->screen_size);
+    gba_color_t backdrop;
+    backdrop.raw = half_from_byte_array(ppu->pram, 0);
+    backdrop.transparent = true;
+
+    for (int screen_x = 0; screen_x < start; screen_x++) {
+        (*line)[screen_x] = backdrop;
     }
 
-    for (int screen_x = 0; screen_x < GBA_SCREEN_X; screen_x++) {
-        word adjusted_x = (word)(x->current.sraw + pa->sraw * screen_x) >> 8;
-        word adjusted_y = (word)(y->current.sraw + pc->sraw * screen_x) >> 8;
+    bool windowed = ppu->DISPCNT.window0_display || ppu->DISPCNT.window1_display || ppu->DISPCNT.obj_window_display;
+    int32_t cur_x = ref_x + dx * start;
+    int32_t cur_y = ref_y + dy * start;
 
-        if (bgcnt->wraparound) {
-            adjusted_x %= bg_width;
-            adjusted_y %= bg_height;
+    for (int chunk_x = start; chunk_x < end; chunk_x += AFFINE_CHUNK) {
+        int n = end - chunk_x < AFFINE_CHUNK ? end - chunk_x : AFFINE_CHUNK;
+        byte tiles[AFFINE_CHUNK];
+
+        for (int i = 0; i < n; i++) {
+            int32_t tx = ((cur_x + dx * i) >> 8) & mask;
+            int32_t ty = ((cur_y + dy * i) >> 8) & mask;
+            byte tid = screen_base[(tx >> 3) + ((ty >> 3) << map_shift)];
+            // Affine tiles are always 256 color, the byte in VRAM is the palette index
+            tiles[i] = character_base[tid * 0x40 + (ty & 7) * 8 + (tx & 7)];
         }
+        cur_x += dx * n;
+        cur_y += dy * n;
 
-        if (adjusted_y < bg_height && adjusted_x < bg_width && should_render_pixel_window(ppu, screen_x, ppu->y, win0in, win1in, winout, objin)) {
-            int se_number = (adjusted_x / 8) + (adjusted_y / 8) * (bg_width / 8);
-            byte tid = ppu->vram[screen_base_addr + se_number];
-            render_tile(ppu, tid, 0, line, screen_x, true, character_base_addr, adjusted_x % 8, adjusted_y % 8);
-        } else {
-            (*line)[screen_x].raw = half_from_byte_array(ppu->pram, 0);
-            (*line)[screen_x].transparent = true;
+        for (int i = 0; i < n; i++) {
+            int screen_x = chunk_x + i;
+            if (!windowed || should_render_pixel_window(ppu, screen_x, ppu->y, win0in, win1in, winout, objin)) {
+                render_tile_pixel(ppu, &(*line)[screen_x], tiles[i], 0, true);
+            } else {
+                (*line)[screen_x] = backdrop;
+            }
         }
     }
+
+    for (int screen_x = end; screen_x < GBA_SCREEN_X; screen_x++) {
+        (*line)[screen_x] = backdrop;
+    }
 }
 
 int background_priorities[4];
@@ -469,16 +597,47 @@ INLINE gba_color_t blend(gba_color_t bottom, byte factor_bottom, gba_color_t top
 gba_color_t white = {{.r = 0x1F, .g = 0x1F, .b = 0x1F}};
 gba_color_t black = {{.r = 0, .g = 0, .b = 0}};
 
-INLINE void merge_bgs(gba_ppu_t* ppu) {
+// Converts a line of merged RGB555 pixels to the output format
+INLINE void output_line(pixel_format_t format, half* merged, byte* line) {
+    switch (format) {
+        case PIXEL_FORMAT_XRGB8888:
+            for (int x = 0; x < GBA_SCREEN_X; x++) {
+                half c = merged[x];
+                byte r = c & 0x1F;
+                byte g = (c >> 5) & 0x1F;
+                byte b = (c >> 10) & 0x1F;
+                line[x * 4 + 0] = 0xFF;
+                line[x * 4 + 1] = FIVEBIT_TO_EIGHTBIT_COLOR(r);
+                line[x * 4 + 2] = FIVEBIT_TO_EIGHTBIT_COLOR(g);
+                line[x * 4 + 3] = FIVEBIT_TO_EIGHTBIT_COLOR(b);
+            }
+            break;
+        case PIXEL_FORMAT_RGB565:
+            for (int x = 0; x < GBA_SCREEN_X; x++) {
+                half c = merged[x];
+                half r = c & 0x1F;
+                half g = (c >> 5) & 0x1F;
+                half b = (c >> 10) & 0x1F;
+                half_to_byte_array(line, x * 2, (r << 11) | (((g << 1) | (g >> 4)) << 5) | b);
+            }
+            break;
+        case PIXEL_FORMAT_RGB555:
+            memcpy(line, merged, GBA_SCREEN_X * sizeof(half));
+            break;
+    }
+}
+
+INLINE void merge_bgs(gba_ppu_t* ppu, byte* line) {
     byte eva = ppu->BLDALPHA.eva >= 0b10000 ? 0b10000 : ppu->BLDALPHA.eva;
     byte evb = ppu->BLDALPHA.evb >= 0b10000 ? 0b10000 : ppu->BLDALPHA.evb;
     byte ey  = ppu->BLDY.ey      >= 0b10000 ? 0b10000 : ppu->BLDY.ey;
 
+    // Backgrounds that don't exist in the current mode weren't rendered this line, whatever DISPCNT says
     bool bg_enabled[] = {
-            ppu->DISPCNT.screen_display_bg0,
-            ppu->DISPCNT.screen_display_bg1,
+            ppu->DISPCNT.screen_display_bg0 && ppu->DISPCNT.mode <= 1,
+            ppu->DISPCNT.screen_display_bg1 && ppu->DISPCNT.mode <= 1,
             ppu->DISPCNT.screen_display_bg2,
-            ppu->DISPCNT.screen_display_bg3};
+            ppu->DISPCNT.screen_display_bg3 && (ppu->DISPCNT.mode == 0 || ppu->DISPCNT.mode == 2)};
 
     bool bg_top[] = {
             ppu->BLDCNT.aBG0,
@@ -498,6 +657,7 @@ INLINE void merge_bgs(gba_ppu_t* ppu) {
             ppu->BLDCNT.bBD
     };
 
+    half merged[GBA_SCREEN_X];
     for (int x = 0; x < GBA_SCREEN_X; x++) {
         gba_color_t last;
         last.raw = half_from_byte_array(ppu->pram, 0);
@@ -505,6 +665,7 @@ INLINE void merge_bgs(gba_ppu_t* ppu) {
         gba_color_t draw = last;
 
         bool should_blend_window = true;
+        bool has_obj = line_mask_get(ppu->obj_drawn, x);
 
         // TODO really should be cacheing all this window stuff and only doing it once per pixel/scanline
         bool win0 = is_win0(ppu, x, ppu->y);
@@ -520,7 +681,7 @@ INLINE void merge_bgs(gba_ppu_t* ppu) {
             should_blend_window = ppu->WININ.win0_color_special_effect_enable;
         } else if (win1 && win1_display) {
             should_blend_window = ppu->WININ.win1_color_special_effect_enable;
-        } else if (ppu->obj_window[x] && winobj_display) {
+        } else if (line_mask_get(ppu->obj_window, x) && winobj_display) {
             should_blend_window = ppu->WINOUT.obj_color_special_effect_enable;
         } else if (winout && winout_display) {
             should_blend_window = ppu->WINOUT.outside_color_special_effect_enable;
@@ -539,7 +700,7 @@ INLINE void merge_bgs(gba_ppu_t* ppu) {
 
             // current layer is enabled for drawing, blending as a _top layer_, and eligible to be blended given above conditions.
             bool should_blend = should_blend_window && (bg_top[bg] && (should_blend_multiple || should_blend_single));
-            bool should_blend_obj = ppu->obj_alpha[x] && (overlaps_target_pixel || should_blend_single);
+            bool should_blend_obj = line_mask_get(ppu->obj_alpha, x) && (overlaps_target_pixel || should_blend_single);
             bool force_obj_std_blend = overlaps_target_pixel;
 
             gba_color_t pixel = ppu->bgbuf[bg][x];
@@ -573,8 +734,8 @@ INLINE void merge_bgs(gba_ppu_t* ppu) {
             }
             // If the OBJ pixel here has the same priority as the BG, draw it instead.
             // "Sprites cover backgrounds of the same priority"
-            if (ppu->obj_priorities[x] == i && !ppu->objbuf[x].transparent) {
-                pixel = ppu->objbuf[x];
+            if (has_obj && ppu->objbuf[x].priority == i) {
+                pixel = ppu->objbuf[x].color;
                 if (should_blend_obj) {
                     byte obj_blend_mode = force_obj_std_blend ? BLD_STD : ppu->BLDCNT.blend_mode;
                     switch (obj_blend_mode) {
@@ -600,11 +761,10 @@ INLINE void merge_bgs(gba_ppu_t* ppu) {
                 last_layer_drawn = BG_OBJ;
             }
         }
-        ppu->screen[ppu->y][x].a = 0xFF;
-        ppu->screen[ppu->y][x].r = FIVEBIT_TO_EIGHTBIT_COLOR(draw.r);
-        ppu->screen[ppu->y][x].g = FIVEBIT_TO_EIGHTBIT_COLOR(draw.g);
-        ppu->screen[ppu->y][x].b = FIVEBIT_TO_EIGHTBIT_COLOR(draw.b);
+        merged[x] = draw.raw & 0x7FFF;
     }
+
+    output_line(ppu->pixel_format, merged, line);
 }
 
 INLINE void render_line_mode0(gba_ppu_t* ppu) {
@@ -630,12 +790,6 @@ INLINE void render_line_mode0(gba_ppu_t* ppu) {
         render_bg_regular(ppu, &ppu->bgbuf[3], &ppu->BG3CNT, ppu->BG3HOFS.offset, ppu->BG3VOFS.offset,
                           ppu->WININ.win0_bg3_enable, ppu->WININ.win1_bg3_enable, ppu->WINOUT.outside_bg3_enable, ppu->WINOUT.obj_bg3_enable);
     }
-
-    dbg_line_drawn();
-
-    refresh_background_priorities(ppu);
-
-    merge_bgs(ppu);
 }
 
 INLINE void render_line_mode1(gba_ppu_t* ppu) {
@@ -658,12 +812,6 @@ INLINE void render_line_mode1(gba_ppu_t* ppu) {
                          ppu->WININ.win0_bg2_enable, ppu->WININ.win1_bg2_enable, ppu->WINOUT.outside_bg2_enable, ppu->WINOUT.obj_bg2_enable,
                          &ppu->BG2X, &ppu->BG2Y, &ppu->BG2PA, &ppu->BG2PB, &ppu->BG2PC, &ppu->BG2PD);
     }
-
-    dbg_line_drawn();
-
-    refresh_background_priorities(ppu);
-
-    merge_bgs(ppu);
 }
 
 INLINE void render_line_mode2(gba_ppu_t* ppu) {
@@ -682,12 +830,26 @@ INLINE void render_line_mode2(gba_ppu_t* ppu) {
                          ppu->WININ.win0_bg3_enable, ppu->WININ.win1_bg3_enable, ppu->WINOUT.outside_bg3_enable, ppu->WINOUT.obj_bg3_enable,
                          &ppu->BG3X, &ppu->BG3Y, &ppu->BG3PA, &ppu->BG3PB, &ppu->BG3PC, &ppu->BG3PD);
     }
+}
 
-    dbg_line_drawn();
-
-    refresh_background_priorities(ppu);
+// Fills a background line with the backdrop color, marked transparent
+INLINE void clear_bg(gba_ppu_t* ppu, gba_color_t (*line)[GBA_SCREEN_X], int from_x) {
+    gba_color_t backdrop;
+    backdrop.raw = half_from_byte_array(ppu->pram, 0);
+    backdrop.transparent = true;
+    for (int x = from_x; x < GBA_SCREEN_X; x++) {
+        (*line)[x] = backdrop;
+    }
+}
 
-    merge_bgs(ppu);
+// Copies a line of 15 bit direct color pixels, clearing bit 15 marks each one as opaque. VRAM is already in host order,
+// so it's one copy and one pass of masking, both of which vectorize.
+INLINE void render_bitmap_direct(gba_color_t (*line)[GBA_SCREEN_X], const byte* pixels, int width) {
+    half* out = &(*line)[0].raw;
+    memcpy(out, pixels, width * sizeof(half));
+    for (int x = 0; x < width; x++) {
+        out[x] &= 0x7FFF;
+    }
 }
 
 void render_line_mode3(gba_ppu_t* ppu) {
@@ -695,23 +857,10 @@ void render_line_mode3(gba_ppu_t* ppu) {
         render_obj(ppu);
     }
     if (ppu->DISPCNT.screen_display_bg2) {
-        for (int x = 0; x < GBA_SCREEN_X; x++) {
-            int offset = x + (ppu->y * GBA_SCREEN_X);
-            offset *= 2;
-
-            ppu->bgbuf[2][x].raw = half_from_byte_array(ppu->vram, offset) & 0x7FFF;
-            ppu->bgbuf[2][x].transparent = false;
-        }
+        render_bitmap_direct(&ppu->bgbuf[2], &ppu->vram[ppu->y * GBA_SCREEN_X * 2], GBA_SCREEN_X);
     } else {
-        for (int x = 0; x < GBA_SCREEN_X; x++) {
-            ppu->bgbuf[2][x].raw = half_from_byte_array(ppu->pram, 0);
-            ppu->bgbuf[2][x].transparent = true;
-        }
+        clear_bg(ppu, &ppu->bgbuf[2], 0);
     }
-
-    dbg_line_drawn();
-    refresh_background_priorities(ppu);
-    merge_bgs(ppu);
 }
 
 void render_line_mode4(gba_ppu_t* ppu) {
@@ -719,32 +868,48 @@ void render_line_mode4(gba_ppu_t* ppu) {
         render_obj(ppu);
     }
     if (ppu->DISPCNT.screen_display_bg2) {
-        for (int x = 0; x < GBA_SCREEN_X; x++) {
-            int offset = x + (ppu->y * GBA_SCREEN_X);
-            int index = ppu->DISPCNT.display_frame_select * 0xA000 + offset;
-            int tile = ppu->vram[index];
-            if (tile == 0) {
-                ppu->bgbuf[2][x].raw = half_from_byte_array(ppu->pram, 0);
-                ppu->bgbuf[2][x].transparent = true;
-            } else {
-                ppu->bgbuf[2][x].raw = half_from_byte_array(ppu->pram, (0x20 * PALETTE_BANK_BACKGROUND + 2 * tile)) & 0x7FFF;
-                ppu->bgbuf[2][x].transparent = false;
-            }
+        const byte* pixels = &ppu->vram[ppu->DISPCNT.display_frame_select * 0xA000 + ppu->y * GBA_SCREEN_X];
+        const half* palette = (const half*)&ppu->pram[0x20 * PALETTE_BANK_BACKGROUND];
+        // The whole palette is converted first, so each pixel is a branch free lookup. With 32 bit entries that vectorizes
+        // as a gather, on targets that have one.
+        word colors[256];
+        for (int i = 0; i < 256; i++) {
+            colors[i] = palette[i] & 0x7FFF;
         }
-    } else {
+        // Index 0 is the backdrop, which is also the first palette entry
+        colors[0] |= 0x8000;
+        half* out = &ppu->bgbuf[2][0].raw;
         for (int x = 0; x < GBA_SCREEN_X; x++) {
-            ppu->bgbuf[2][x].raw = half_from_byte_array(ppu->pram, 0);
-            ppu->bgbuf[2][x].transparent = true;
+            out[x] = colors[pixels[x]];
         }
+    } else {
+        clear_bg(ppu, &ppu->bgbuf[2], 0);
     }
+}
 
-    dbg_line_drawn();
-    refresh_background_priorities(ppu);
-    merge_bgs(ppu);
+// Mode 5 is direct color like mode 3, but with a smaller frame so there's room for two pages
+#define MODE5_WIDTH 160
+#define MODE5_HEIGHT 128
+
+void render_line_mode5(gba_ppu_t* ppu) {
+    if (ppu->DISPCNT.screen_display_obj) {
+        render_obj(ppu);
+    }
+    if (ppu->DISPCNT.screen_display_bg2 && ppu->y < MODE5_HEIGHT) {
+        word offset = ppu->DISPCNT.display_frame_select * 0xA000 + ppu->y * MODE5_WIDTH * 2;
+        render_bitmap_direct(&ppu->bgbuf[2], &ppu->vram[offset], MODE5_WIDTH);
+        clear_bg(ppu, &ppu->bgbuf[2], MODE5_WIDTH);
+    } else {
+        clear_bg(ppu, &ppu->bgbuf[2], 0);
+    }
 }
 
 
-INLINE void render_line(gba_ppu_t* ppu) {
+void render_line(gba_ppu_t* ppu, byte* line) {
+    refresh_tile_cache(ppu);
+    if (!ppu->DISPCNT.screen_display_obj) {
+        clear_obj(ppu);
+    }
     // Draw a pixel
     switch (ppu->DISPCNT.mode) {
         case 0:
@@ -762,9 +927,99 @@ INLINE void render_line(gba_ppu_t* ppu) {
         case 4:
             render_line_mode4(ppu);
             break;
+        case 5:
+            render_line_mode5(ppu);
+            break;
         default:
             logfatal("Unknown graphics mode: %d", ppu->DISPCNT.mode)
     }
+
+    refresh_background_priorities(ppu);
+    merge_bgs(ppu, line);
+}
+
+INLINE void signature_read_vram(line_signature_t* signature, gba_ppu_t* ppu, word start, word size) {
+    for (int region = start / VRAM_REGION_SIZE; region <= (start + size - 1) / VRAM_REGION_SIZE; region++) {
+        signature->vram_generation[region] = ppu->vram_generation[region];
+    }
+}
+
+// Returns false if the current line would come out the same as its row from last frame
+INLINE bool update_line_signature(gba_ppu_t* ppu) {
+    line_signature_t signature;
+    memset(&signature, 0, sizeof(line_signature_t));
+    signature.valid = true;
+    memcpy(signature.registers, (byte*)ppu + PPU_RENDER_REGISTERS_START, PPU_RENDER_REGISTERS_SIZE);
+    signature.pram_generation = ppu->pram_generation;
+
+    if (ppu->DISPCNT.screen_display_obj) {
+        signature.oam_generation = ppu->oam_generation;
+        signature_read_vram(&signature, ppu, 0x10000, 0x8000);
+    }
+
+    word page = ppu->DISPCNT.display_frame_select * 0xA000;
+    switch (ppu->DISPCNT.mode) {
+        case 3:
+            signature_read_vram(&signature, ppu, ppu->y * GBA_SCREEN_X * 2, GBA_SCREEN_X * 2);
+            break;
+        case 4:
+            signature_read_vram(&signature, ppu, page + ppu->y * GBA_SCREEN_X, GBA_SCREEN_X);
+            break;
+        case 5:
+            if (ppu->y < MODE5_HEIGHT) {
+                signature_read_vram(&signature, ppu, page + ppu->y * MODE5_WIDTH * 2, MODE5_WIDTH * 2);
+            }
+            break;
+        default: // Tile and map addresses in the tiled modes can run past the background area, so this is all of it
+            signature_read_vram(&signature, ppu, 0, VRAM_SIZE);
+            break;
+    }
+
+    line_signature_t* last = &line_signatures[ppu->y];
+    if (memcmp(last, &signature, sizeof(line_signature_t)) == 0) {
+        return false;
+    }
+    *last = signature;
+    return true;
+}
+
+static render_policy_t render_policy = RENDER_ALWAYS;
+static int render_frameskip = 1;
+static int frames_until_render = 0;
+static bool frame_requested = false;
+static bool render_this_frame = true;
+
+INLINE bool should_render_frame() {
+    switch (render_policy) {
+        case RENDER_ALWAYS:
+            return true;
+        case RENDER_FRAMESKIP:
+            if (--frames_until_render <= 0) {
+                frames_until_render = render_frameskip;
+                return true;
+            }
+            return false;
+        case RENDER_ON_REQUEST: {
+            bool requested = frame_requested;
+            frame_requested = false;
+            return requested;
+        }
+        case RENDER_NEVER:
+            return false;
+    }
+    return true;
+}
+
+void set_render_policy(render_policy_t policy, int frameskip) {
+    render_policy = policy;
+    render_frameskip = frameskip < 1 ? 1 : frameskip;
+    frames_until_render = 0;
+    frame_requested = false;
+    render_this_frame = should_render_frame();
+}
+
+void ppu_request_frame() {
+    frame_requested = true;
 }
 
 void ppu_hblank(gba_ppu_t* ppu) {
@@ -775,8 +1030,18 @@ void ppu_hblank(gba_ppu_t* ppu) {
         request_interrupt(IRQ_HBLANK);
     }
     ppu->DISPSTAT.hblank = true;
-    if (ppu->y < GBA_SCREEN_Y && !ppu->DISPCNT.forced_blank) { // i.e. not VBlank
-        render_line(ppu);
+    if (ppu->y < GBA_SCREEN_Y && render_this_frame) { // i.e. not VBlank
+        if (ppu->DISPCNT.forced_blank) {
+            line_signatures[ppu->y].valid = false;
+            memset(&ppu->screen[ppu->y * ppu->screen_pitch], 0, ppu->screen_pitch);
+            ppu->dirty_rows[ppu->y / 64] |= 1ull << (ppu->y % 64);
+        } else if (update_line_signature(ppu) || dbg_window_visible) {
+            ppu->dirty_rows[ppu->y / 64] |= 1ull << (ppu->y % 64);
+            if (!ppu_worker_queue_line(ppu)) {
+                render_line(ppu, &ppu->screen[ppu->y * ppu->screen_pitch]);
+                dbg_line_drawn();
+            }
+        }
     }
 }
 
@@ -786,7 +1051,19 @@ void ppu_vblank(gba_ppu_t* ppu) {
         request_interrupt(IRQ_VBLANK);
     }
     ppu->DISPSTAT.vblank = true;
-    render_screen(&ppu->screen);
+    ppu_worker_sync();
+    // Has to happen before presenting, which clears dirty_rows
+    byte* finished = ppu->screen;
+    frame_pipeline_submit(ppu);
+    if (render_this_frame && ppu->enable_graphics) {
+        render_screen(finished, ppu->screen_pitch, ppu->dirty_rows);
+    } else {
+        // Nothing is going to upload these, and the pipeline already has them. Left set, they'd be copied again every frame.
+        memset(ppu->dirty_rows, 0, sizeof(ppu->dirty_rows));
+        if (render_policy != RENDER_NEVER) { // Which runs as fast as it can
+            render_skipped_frame();
+        }
+    }
 }
 
 void check_vcount(gba_ppu_t* ppu) {
@@ -821,6 +1098,7 @@ void ppu_end_vblank(gba_ppu_t* ppu) {
     ppu->BG3Y.current.raw = ppu->BG3Y.initial.raw;
 
     ppu->y = 0;
+    render_this_frame = should_render_frame();
     check_vcount(ppu);
     dbg_tick(FRAME);
     ppu->DISPSTAT.vblank = false;
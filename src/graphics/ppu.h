@@ -2,12 +2,14 @@
 #define GBA_PPU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "../common/util.h"
 
 #define GBA_SCREEN_X 240
 #define GBA_SCREEN_HBLANK 68
 #define GBA_SCREEN_Y 160
 #define GBA_SCREEN_VBLANK 68
+#define SCREEN_ROW_MASK_WORDS ((GBA_SCREEN_Y + 63) / 64)
 
 #define PRAM_SIZE  0x400
 #define VRAM_SIZE  0x18000
@@ -16,8 +18,28 @@
 #define SCREENBLOCK_SIZE 0x800
 #define CHARBLOCK_SIZE  0x4000
 
+// VRAM is tracked for the tile cache in 32 byte slots, the size of one 4bpp tile
+#define VRAM_TILE_SIZE 0x20
+#define VRAM_NUM_TILES (VRAM_SIZE / VRAM_TILE_SIZE)
+// and in charblock sized regions for the line cache
+#define VRAM_REGION_SIZE CHARBLOCK_SIZE
+#define VRAM_NUM_REGIONS (VRAM_SIZE / VRAM_REGION_SIZE)
+
 #define FIVEBIT_TO_EIGHTBIT_COLOR(c) ((c<<3)|(c&7))
 
+typedef enum pixel_format {
+    PIXEL_FORMAT_XRGB8888, // X, R, G, B in byte order, the same layout as color_t
+    PIXEL_FORMAT_RGB565,
+    PIXEL_FORMAT_RGB555    // The GBA's own format, red in the low bits. No conversion at all.
+} pixel_format_t;
+
+INLINE int pixel_format_size(pixel_format_t format) {
+    return format == PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+}
+
+// Big enough for a frame in any pixel format
+#define SCREEN_BUFFER_SIZE (GBA_SCREEN_Y * GBA_SCREEN_X * 4)
+
 typedef union DISPCNT {
     struct {
         unsigned mode:3;
@@ -111,6 +133,23 @@ typedef union gba_color {
     half raw;
 } gba_color_t;
 
+typedef struct obj_pixel {
+    gba_color_t color;
+    byte priority;
+} obj_pixel_t;
+
+// One bit per pixel on a line
+#define LINE_MASK_WORDS ((GBA_SCREEN_X + 63) / 64)
+typedef uint64_t line_mask_t[LINE_MASK_WORDS];
+
+INLINE bool line_mask_get(const uint64_t* mask, int x) {
+    return (mask[x / 64] >> (x % 64)) & 1;
+}
+
+INLINE void line_mask_set(uint64_t* mask, int x) {
+    mask[x / 64] |= 1ull << (x % 64);
+}
+
 typedef union DISPSTAT {
     struct {
         // Read only
@@ -257,18 +296,32 @@ typedef union addr_28b {
 typedef struct gba_ppu {
     // State
     half y;
-    color_t screen[GBA_SCREEN_Y][GBA_SCREEN_X];
+    // GBA_SCREEN_Y rows of screen_pitch bytes each, in pixel_format. Points at whichever of screen_buffers is being drawn.
+    byte* screen;
+    // The other buffer holds the previous frame, which the frame pipeline may still be handing to its consumers
+    byte screen_buffers[2][SCREEN_BUFFER_SIZE] __attribute__ ((aligned (16)));
+    // One bit per row of screen written since it was last presented
+    uint64_t dirty_rows[SCREEN_ROW_MASK_WORDS];
     gba_color_t bgbuf[4][GBA_SCREEN_X];
-    gba_color_t objbuf[GBA_SCREEN_X];
-    byte obj_priorities[GBA_SCREEN_X];
-    bool obj_alpha[GBA_SCREEN_X];
-    bool obj_window[GBA_SCREEN_X];
+    // Only meaningful for pixels set in obj_drawn, so none of it has to be cleared between lines
+    obj_pixel_t objbuf[GBA_SCREEN_X];
+    line_mask_t obj_drawn;
+    line_mask_t obj_alpha;
+    line_mask_t obj_window;
 
     // Memory
     byte pram[PRAM_SIZE];
     byte vram[VRAM_SIZE];
     byte oam[OAM_SIZE];
 
+    // One bit per VRAM_TILE_SIZE slot written since the tile cache was last refreshed
+    uint64_t vram_dirty[VRAM_NUM_TILES / 64];
+    bool pram_dirty;
+    bool oam_dirty;
+    // Bumped on every write, so a line can tell whether the memory it was drawn from has changed since
+    word vram_generation[VRAM_NUM_REGIONS];
+    word pram_generation;
+    word oam_generation;
 
     // Registers
     DISPCNT_t DISPCNT;
@@ -316,8 +369,14 @@ typedef struct gba_ppu {
     DISPSTAT_t DISPSTAT;
 
     bool enable_graphics;
+    pixel_format_t pixel_format;
+    int screen_pitch;
 } gba_ppu_t;
 
+// Every register that affects how a line is drawn, DISPCNT up to (but not including) DISPSTAT
+#define PPU_RENDER_REGISTERS_START offsetof(gba_ppu_t, DISPCNT)
+#define PPU_RENDER_REGISTERS_SIZE (offsetof(gba_ppu_t, DISPSTAT) - PPU_RENDER_REGISTERS_START)
+
 typedef union obj_attr0 {
     struct {
         unsigned y:8;
@@ -364,6 +423,13 @@ typedef union reg_se {
     };
 } reg_se_t;
 
+typedef enum render_policy {
+    RENDER_ALWAYS,
+    RENDER_FRAMESKIP,  // Render one frame out of every N
+    RENDER_ON_REQUEST, // Render the frame after each call to ppu_request_frame()
+    RENDER_NEVER
+} render_policy_t;
+
 extern int sprite_heights[3][4];
 extern int sprite_widths[3][4];
 
@@ -373,6 +439,30 @@ void ppu_hblank(gba_ppu_t* ppu);
 void ppu_vblank(gba_ppu_t* ppu);
 void ppu_end_hblank(gba_ppu_t* ppu);
 void ppu_end_vblank(gba_ppu_t* ppu);
+void ppu_invalidate_caches(gba_ppu_t* ppu);
+void render_line(gba_ppu_t* ppu, byte* line);
+// Also clears the screen, since whatever was in it was in the old format
+void ppu_set_pixel_format(gba_ppu_t* ppu, pixel_format_t format);
+// Skipped frames still run all of the PPU's timing, IRQs, DMA triggers and affine reference point updates,
+// only the drawing itself is left out.
+void set_render_policy(render_policy_t policy, int frameskip);
+void ppu_request_frame();
+
+INLINE void mark_vram_dirty(gba_ppu_t* ppu, word index) {
+    word slot = index / VRAM_TILE_SIZE;
+    ppu->vram_dirty[slot / 64] |= 1ull << (slot % 64);
+    ppu->vram_generation[index / VRAM_REGION_SIZE]++;
+}
+
+INLINE void mark_pram_dirty(gba_ppu_t* ppu) {
+    ppu->pram_dirty = true;
+    ppu->pram_generation++;
+}
+
+INLINE void mark_oam_dirty(gba_ppu_t* ppu) {
+    ppu->oam_dirty = true;
+    ppu->oam_generation++;
+}
 
 INLINE bool is_vblank(gba_ppu_t* ppu) {
     return ppu->y > GBA_SCREEN_Y && ppu->y != 227;
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "ppu_worker.h"
+#include "debug.h"
+#include "../common/log.h"
+
+// Lines are rendered on a worker thread that owns its own copy of the PPU. Each queued line carries a snapshot of the
+// registers plus whatever VRAM/PRAM/OAM changed since the previous line, so mid-frame raster effects still land on
+// the right line while the emulation thread keeps running.
+
+#define PPU_JOB_QUEUE_SIZE 8
+
+typedef enum ppu_job_type {
+    PPU_JOB_LINE,
+    PPU_JOB_SYNC,
+    PPU_JOB_QUIT
+} ppu_job_type_t;
+
+typedef struct ppu_job {
+    ppu_job_type_t type;
+    half y;
+    pixel_format_t pixel_format;
+    byte registers[PPU_RENDER_REGISTERS_SIZE];
+
+    // Only the slots set in vram_dirty are copied into vram, at their usual offsets
+    uint64_t vram_dirty[VRAM_NUM_TILES / 64];
+    bool pram_dirty;
+    bool oam_dirty;
+    byte vram[VRAM_SIZE];
+    byte pram[PRAM_SIZE];
+    byte oam[OAM_SIZE];
+} ppu_job_t;
+
+static SDL_Thread* worker_thread = NULL;
+static SDL_sem* free_jobs = NULL;
+static SDL_sem* queued_jobs = NULL;
+static SDL_sem* synced = NULL;
+
+static ppu_job_t* jobs = NULL;
+static int job_write_index = 0;
+static int job_read_index = 0;
+
+static gba_ppu_t* shadow = NULL; // Only touched by the worker thread
+static gba_ppu_t* target = NULL; // Finished lines are written to target->screen
+
+// Set when a line had to be rendered inline, the shadow copy has missed those changes
+static bool shadow_stale = false;
+
+INLINE ppu_job_t* begin_job(ppu_job_type_t type) {
+    SDL_SemWait(free_jobs);
+    ppu_job_t* job = &jobs[job_write_index];
+    job_write_index = (job_write_index + 1) % PPU_JOB_QUEUE_SIZE;
+    job->type = type;
+    return job;
+}
+
+INLINE void submit_job() {
+    SDL_SemPost(queued_jobs);
+}
+
+INLINE void apply_job(ppu_job_t* job) {
+    shadow->y = job->y;
+    shadow->pixel_format = job->pixel_format;
+    memcpy((byte*)shadow + PPU_RENDER_REGISTERS_START, job->registers, PPU_RENDER_REGISTERS_SIZE);
+
+    for (int i = 0; i < VRAM_NUM_TILES / 64; i++) {
+        uint64_t dirty = job->vram_dirty[i];
+        shadow->vram_dirty[i] |= dirty;
+        while (dirty) {
+            word index = (i * 64 + ctz(dirty)) * VRAM_TILE_SIZE;
+            memcpy(&shadow->vram[index], &job->vram[index], VRAM_TILE_SIZE);
+            dirty &= dirty - 1;
+        }
+    }
+
+    if (job->pram_dirty) {
+        memcpy(shadow->pram, job->pram, PRAM_SIZE);
+    }
+
+    if (job->oam_dirty) {
+        memcpy(shadow->oam, job->oam, OAM_SIZE);
+    }
+}
+
+static int ppu_worker_main(void* data) {
+    while (true) {
+        SDL_SemWait(queued_jobs);
+        ppu_job_t* job = &jobs[job_read_index];
+        job_read_index = (job_read_index + 1) % PPU_JOB_QUEUE_SIZE;
+
+        switch (job->type) {
+            case PPU_JOB_LINE:
+                apply_job(job);
+                render_line(shadow, &target->screen[job->y * GBA_SCREEN_X * pixel_format_size(job->pixel_format)]);
+                break;
+            case PPU_JOB_SYNC:
+                SDL_SemPost(synced);
+                break;
+            case PPU_JOB_QUIT:
+                SDL_SemPost(free_jobs);
+                return 0;
+        }
+        SDL_SemPost(free_jobs);
+    }
+}
+
+void ppu_worker_start(gba_ppu_t* ppu) {
+    if (worker_thread) {
+        return;
+    }
+
+    jobs = malloc(PPU_JOB_QUEUE_SIZE * sizeof(ppu_job_t));
+    shadow = calloc(1, sizeof(gba_ppu_t));
+    target = ppu;
+    job_write_index = 0;
+    job_read_index = 0;
+    shadow_stale = false;
+
+    free_jobs = SDL_CreateSemaphore(PPU_JOB_QUEUE_SIZE);
+    queued_jobs = SDL_CreateSemaphore(0);
+    synced = SDL_CreateSemaphore(0);
+
+    // The shadow starts out empty, so the first line has to bring everything along with it
+    ppu_invalidate_caches(ppu);
+
+    worker_thread = SDL_CreateThread(ppu_worker_main, "ppu", NULL);
+    if (!worker_thread) {
+        logfatal("Unable to start PPU worker thread: %s", SDL_GetError())
+    }
+}
+
+void ppu_worker_stop() {
+    if (!worker_thread) {
+        return;
+    }
+
+    begin_job(PPU_JOB_QUIT);
+    submit_job();
+    SDL_WaitThread(worker_thread, NULL);
+    worker_thread = NULL;
+
+    SDL_DestroySemaphore(free_jobs);
+    SDL_DestroySemaphore(queued_jobs);
+    SDL_DestroySemaphore(synced);
+    free(jobs);
+    jobs = NULL;
+    free(shadow);
+    shadow = NULL;
+    target = NULL;
+}
+
+bool ppu_worker_queue_line(gba_ppu_t* ppu) {
+    if (!worker_thread) {
+        return false;
+    }
+
+    // The debugger wants to see each line as soon as it's drawn, so render inline while it's open
+    if (dbg_window_visible) {
+        ppu_worker_sync();
+        shadow_stale = true;
+        return false;
+    }
+
+    if (shadow_stale) {
+        ppu_invalidate_caches(ppu);
+        shadow_stale = false;
+    }
+
+    ppu_job_t* job = begin_job(PPU_JOB_LINE);
+    job->y = ppu->y;
+    job->pixel_format = ppu->pixel_format;
+    memcpy(job->registers, (byte*)ppu + PPU_RENDER_REGISTERS_START, PPU_RENDER_REGISTERS_SIZE);
+
+    for (int i = 0; i < VRAM_NUM_TILES / 64; i++) {
+        uint64_t dirty = ppu->vram_dirty[i];
+        job->vram_dirty[i] = dirty;
+        ppu->vram_dirty[i] = 0;
+        while (dirty) {
+            word index = (i * 64 + ctz(dirty)) * VRAM_TILE_SIZE;
+            memcpy(&job->vram[index], &ppu->vram[index], VRAM_TILE_SIZE);
+            dirty &= dirty - 1;
+        }
+    }
+
+    job->pram_dirty = ppu->pram_dirty;
+    if (ppu->pram_dirty) {
+        memcpy(job->pram, ppu->pram, PRAM_SIZE);
+        ppu->pram_dirty = false;
+    }
+
+    job->oam_dirty = ppu->oam_dirty;
+    if (ppu->oam_dirty) {
+        memcpy(job->oam, ppu->oam, OAM_SIZE);
+        ppu->oam_dirty = false;
+    }
+
+    submit_job();
+    return true;
+}
+
+void ppu_worker_sync() {
+    if (!worker_thread) {
+        return;
+    }
+
+    begin_job(PPU_JOB_SYNC);
+    submit_job();
+    SDL_SemWait(synced);
+}
@@ -0,0 +1,13 @@
+#ifndef GBA_PPU_WORKER_H
+#define GBA_PPU_WORKER_H
+
+#include "ppu.h"
+
+void ppu_worker_start(gba_ppu_t* ppu);
+void ppu_worker_stop();
+// Returns false if the line wasn't queued and needs to be rendered inline
+bool ppu_worker_queue_line(gba_ppu_t* ppu);
+// Blocks until every queued line has been written to ppu->screen
+void ppu_worker_sync();
+
+#endif //GBA_PPU_WORKER_H
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <SDL.h>
 #include <SDL_gamecontroller.h>
 
@@ -5,7 +6,9 @@
 #include "../common/log.h"
 #include "../mem/gbabus.h"
 #include "debug.h"
+#include "scaler.h"
 #include "../gba_system.h"
+#include "../audio/audio.h"
 
 static int SCREEN_SCALE = 4;
 
@@ -13,6 +16,21 @@ void set_screen_scale(int scale) {
     SCREEN_SCALE = scale;
 }
 
+// With a CPU filter the texture holds the filtered frame, scale_factor times the size of the screen
+static scale_filter_t scale_filter = SCALE_FILTER_NONE;
+static int scale_factor = 1;
+
+void set_scale_filter(scale_filter_t filter) {
+    scale_filter = filter;
+}
+
+// When the audio device paces emulation, presenting mustn't also wait on vsync
+static bool audio_paced = false;
+
+void set_audio_paced(bool paced) {
+    audio_paced = paced;
+}
+
 static bool initialized = false;
 static bool ctrl_state = false;
 static SDL_Window* window = NULL;
@@ -20,6 +38,30 @@ static uint32_t window_id;
 static SDL_Renderer* renderer = NULL;
 static SDL_Texture* buffer = NULL;
 
+// When presenting from the main thread, emulation runs on its own thread and hands finished frames over through three
+// buffers: the one being written, the newest finished one, and the one on screen. Neither side ever waits on the other.
+static bool threaded_presentation = false;
+static SDL_mutex* frame_lock = NULL;
+static SDL_cond* frame_available = NULL;
+static byte frames[3][SCREEN_BUFFER_SIZE];
+static int write_frame = 0;
+static int ready_frame = 1;
+static int display_frame = 2;
+static bool frame_ready = false;
+// Rows changed in any frame handed over since the presentation thread last uploaded one
+static uint64_t pending_dirty_rows[SCREEN_ROW_MASK_WORDS];
+
+// Save state requests from the presentation thread, run by the emulation thread at the next VBlank
+static int pending_state_slot = -1;
+static bool pending_state_load = false;
+// Same for input. The presentation thread updates this copy, the emulation thread copies it into KEYINPUT.
+static KEYINPUT_t pending_keyinput = {.raw = 0x03FF};
+
+// Emulation is paced to the GBA's refresh rate, unless fast forward (tab) is held. 1232 cycles a line, 228 lines.
+#define GBA_FRAME_NS (1000000000ull * 1232 * 228 / CPU_FREQUENCY)
+static bool fast_forward = false;
+static uint64_t next_frame_time = 0;
+
 // TODO: Support multiple, maybe up to 4?
 SDL_GameController* controller = NULL;
 SDL_Joystick* joystick = NULL;
@@ -49,6 +91,18 @@ void gba_refresh_gamepads() {
     }
 }
 
+Uint32 texture_format(pixel_format_t format) {
+    switch (format) {
+        case PIXEL_FORMAT_XRGB8888:
+            return SDL_PIXELFORMAT_ARGB32;
+        case PIXEL_FORMAT_RGB565:
+            return SDL_PIXELFORMAT_RGB565;
+        case PIXEL_FORMAT_RGB555:
+            return SDL_PIXELFORMAT_XBGR1555;
+    }
+    logfatal("Unknown pixel format: %d", format)
+}
+
 void initialize() {
     initialized = true;
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER) < 0) {
@@ -63,8 +117,16 @@ void initialize() {
             SDL_WINDOW_SHOWN);
     window_id = SDL_GetWindowID(window);
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    buffer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB32, SDL_TEXTUREACCESS_STREAMING, GBA_SCREEN_X, GBA_SCREEN_Y);
+    // Presenting from its own thread doesn't hold emulation back, so vsync can stay on there
+    Uint32 renderer_flags = SDL_RENDERER_ACCELERATED;
+    if (!audio_paced || threaded_presentation) {
+        renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+    renderer = SDL_CreateRenderer(window, -1, renderer_flags);
+    scaler_init(scale_filter, SCREEN_SCALE);
+    scale_factor = scale_filter_factor(scale_filter, SCREEN_SCALE);
+    buffer = SDL_CreateTexture(renderer, texture_format(ppu->pixel_format), SDL_TEXTUREACCESS_STREAMING,
+                               GBA_SCREEN_X * scale_factor, GBA_SCREEN_Y * scale_factor);
 
     if (renderer == NULL) {
         logfatal("SDL couldn't create a renderer! %s", SDL_GetError());
@@ -74,7 +136,13 @@ void initialize() {
 }
 
 void save_load(bool state, int i) {
-    if (state) {
+    if (state && threaded_presentation) {
+        // Has to happen on the emulation thread
+        SDL_LockMutex(frame_lock);
+        pending_state_slot = i;
+        pending_state_load = ctrl_state;
+        SDL_UnlockMutex(frame_lock);
+    } else if (state) {
         if (ctrl_state) {
             load_state(mem->savestate_path[i]);
         } else {
@@ -83,8 +151,24 @@ void save_load(bool state, int i) {
     }
 }
 
+// Input handlers have to hold frame_lock around any changes when presenting from a separate thread
+INLINE KEYINPUT_t* lock_keyinput() {
+    if (threaded_presentation) {
+        SDL_LockMutex(frame_lock);
+        return &pending_keyinput;
+    }
+    return get_keyinput();
+}
+
+INLINE void unlock_keyinput() {
+    if (threaded_presentation) {
+        SDL_UnlockMutex(frame_lock);
+    }
+}
+
 void update_key(SDL_Keycode sdlk, bool state) {
-    KEYINPUT_t* KEYINPUT = get_keyinput();
+    // SDL mutexes are recursive, so save_load taking frame_lock again below is fine
+    KEYINPUT_t* KEYINPUT = lock_keyinput();
     switch (sdlk) {
         case SDLK_LCTRL:
         case SDLK_RCTRL:
@@ -127,6 +211,10 @@ void update_key(SDL_Keycode sdlk, bool state) {
         case SDLK_q:
             KEYINPUT->l = !state;
             break;
+        case SDLK_TAB:
+            __atomic_store_n(&fast_forward, state, __ATOMIC_RELAXED);
+            set_audio_fast_forward(state);
+            break;
         case SDLK_e:
             KEYINPUT->r = !state;
             break;
@@ -163,10 +251,11 @@ void update_key(SDL_Keycode sdlk, bool state) {
         default:
             break;
     }
+    unlock_keyinput();
 }
 
 void update_joybutton(byte button, bool state) {
-    KEYINPUT_t* KEYINPUT = get_keyinput();
+    KEYINPUT_t* KEYINPUT = lock_keyinput();
     switch (button) {
         case SDL_CONTROLLER_BUTTON_DPAD_UP:
             KEYINPUT->up = !state;
@@ -202,6 +291,7 @@ void update_joybutton(byte button, bool state) {
         default:
             break;
     }
+    unlock_keyinput();
 }
 
 int16_t joyx, joyy;
@@ -210,7 +300,7 @@ int16_t joyx, joyy;
 #define CHECKSLICE(degrees, angle) (degrees > (angle - SLICE_OFFSET) && degrees < (angle + SLICE_OFFSET))
 
 void update_joyaxis(byte axis, int16_t value) {
-    KEYINPUT_t* KEYINPUT = get_keyinput();
+    KEYINPUT_t* KEYINPUT = lock_keyinput();
     switch (axis) {
         case SDL_CONTROLLER_AXIS_LEFTX:
             joyx = value;
@@ -248,6 +338,7 @@ void update_joyaxis(byte axis, int16_t value) {
         // Slightly different since it's around the 0 angle
         KEYINPUT->right = !(degrees < SLICE_OFFSET || degrees > (360 - SLICE_OFFSET));
     }
+    unlock_keyinput();
 }
 
 void gba_handle_event(SDL_Event* event) {
@@ -259,7 +350,11 @@ void gba_handle_event(SDL_Event* event) {
         case SDL_KEYDOWN:
             if (event->key.windowID == window_id) {
                 if (event->key.keysym.sym == SDLK_o) {
-                    set_dbg_window_visibility(true);
+                    if (threaded_presentation) {
+                        logwarn("The debugger isn't available while presenting from a separate thread")
+                    } else {
+                        set_dbg_window_visibility(true);
+                    }
                 } else {
                     update_key(event->key.keysym.sym, true);
                 }
@@ -295,38 +390,222 @@ uint32_t sdl_numframes = 0;
 uint32_t sdl_fps = 0;
 char sdl_wintitle[16] = "dgb gba 00 FPS";
 
-void render_screen(color_t (*screen)[GBA_SCREEN_Y][GBA_SCREEN_X]) {
-    if (!ppu->enable_graphics) {
-        return;
-    }
+INLINE void handle_events() {
     if (!initialized) {
         initialize();
     }
 
     SDL_Event event;
-    while (SDL_PollEvent(&event)) {
+    while (!should_quit && SDL_PollEvent(&event)) {
         debug_handle_event(&event);
         gba_handle_event(&event);
     }
+}
 
-    SDL_UpdateTexture(buffer, NULL, screen, GBA_SCREEN_X * 4);
-    SDL_RenderCopy(renderer, buffer, NULL, NULL);
-    loginfo("Updating renderer")
-    SDL_RenderPresent(renderer);
-    sdl_numframes++;
+// Copies rows [first, last) into the streaming texture, through the scaler if there is one
+INLINE void upload_rows(byte* screen, int screen_pitch, int first, int last) {
+    SDL_Rect rect = {0, first * scale_factor, GBA_SCREEN_X * scale_factor, (last - first) * scale_factor};
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(buffer, &rect, &pixels, &pitch) < 0) {
+        logfatal("SDL couldn't lock the screen texture! %s", SDL_GetError());
+    }
+    if (scale_filter == SCALE_FILTER_NONE) {
+        for (int y = first; y < last; y++) {
+            memcpy((byte*)pixels + (y - first) * pitch, &screen[y * screen_pitch], screen_pitch);
+        }
+    } else {
+        scaler_run(screen, screen_pitch, ppu->pixel_format, first, last, pixels, pitch);
+    }
+    SDL_UnlockTexture(buffer);
+}
+
+INLINE void upload_dirty_rows(byte* screen, int pitch, uint64_t* dirty_rows) {
+    // A changed row also changes the filtered output of the rows around it
+    int radius = scale_filter_radius(scale_filter);
+    if (radius > 0) {
+        uint64_t grown[SCREEN_ROW_MASK_WORDS] = {0};
+        for (int y = 0; y < GBA_SCREEN_Y; y++) {
+            if ((dirty_rows[y / 64] >> (y % 64)) & 1) {
+                for (int ny = y - radius; ny <= y + radius; ny++) {
+                    if (ny >= 0 && ny < GBA_SCREEN_Y) {
+                        grown[ny / 64] |= 1ull << (ny % 64);
+                    }
+                }
+            }
+        }
+        memcpy(dirty_rows, grown, sizeof(grown));
+    }
+
+    int y = 0;
+    while (y < GBA_SCREEN_Y) {
+        if (!((dirty_rows[y / 64] >> (y % 64)) & 1)) {
+            y++;
+            continue;
+        }
+        int first = y;
+        while (y < GBA_SCREEN_Y && ((dirty_rows[y / 64] >> (y % 64)) & 1)) {
+            y++;
+        }
+        upload_rows(screen, pitch, first, y);
+    }
+    memset(dirty_rows, 0, SCREEN_ROW_MASK_WORDS * sizeof(uint64_t));
+}
+
+INLINE void update_fps(uint32_t frames_since_last) {
     uint32_t ticks = SDL_GetTicks();
     if (sdl_lastframe < ticks - fps_interval) {
         sdl_lastframe = ticks;
-        sdl_fps = sdl_numframes;
-        sdl_numframes = 0;
+        sdl_fps = frames_since_last;
         snprintf(sdl_wintitle, sizeof(sdl_wintitle), "dgb gba %02d FPS", sdl_fps);
         SDL_SetWindowTitle(window, sdl_wintitle);
     }
-    for (int y = 0; y < GBA_SCREEN_Y; y++) {
-        for (int x = 0; x < GBA_SCREEN_X; x++) {
-            (*screen)[y][x].r = 0;
-            (*screen)[y][x].g = 0;
-            (*screen)[y][x].b = 0;
+}
+
+INLINE void present() {
+    SDL_RenderCopy(renderer, buffer, NULL, NULL);
+    loginfo("Updating renderer")
+    SDL_RenderPresent(renderer);
+}
+
+// When presenting from another thread, nothing waits on vsync here, so emulation is paced by the clock instead
+INLINE void wait_for_frame_time() {
+    if (audio_paced) {
+        return;
+    }
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t frame_ticks = GBA_FRAME_NS * SDL_GetPerformanceFrequency() / 1000000000ull;
+    if (__atomic_load_n(&fast_forward, __ATOMIC_RELAXED) || next_frame_time == 0 || now > next_frame_time + frame_ticks) {
+        // Don't try to catch up after falling behind (or after fast forwarding)
+        next_frame_time = now + frame_ticks;
+    } else {
+        if (next_frame_time > now) {
+            SDL_Delay((next_frame_time - now) * 1000 / SDL_GetPerformanceFrequency());
         }
+        next_frame_time += frame_ticks;
     }
 }
+
+// Runs whatever the presentation thread queued up since the last frame, on the emulation thread
+INLINE void take_presentation_requests() {
+    SDL_LockMutex(frame_lock);
+    half keyinput = pending_keyinput.raw;
+    int slot = pending_state_slot;
+    bool load = pending_state_load;
+    pending_state_slot = -1;
+    SDL_UnlockMutex(frame_lock);
+
+    if (slot >= 0) {
+        if (load) {
+            load_state(mem->savestate_path[slot]);
+        } else {
+            save_state(mem->savestate_path[slot]);
+        }
+    }
+    // After loading, which brings the saved KEYINPUT along with the rest of the bus
+    get_keyinput()->raw = keyinput;
+}
+
+// Hands the frame to the presentation thread, then waits out whatever is left of this frame's time
+INLINE void publish_frame(byte* screen, int pitch, uint64_t* dirty_rows) {
+    memcpy(frames[write_frame], screen, pitch * GBA_SCREEN_Y);
+
+    SDL_LockMutex(frame_lock);
+    int published = write_frame;
+    write_frame = ready_frame;
+    ready_frame = published;
+    frame_ready = true;
+    for (int i = 0; i < SCREEN_ROW_MASK_WORDS; i++) {
+        pending_dirty_rows[i] |= dirty_rows[i];
+        dirty_rows[i] = 0;
+    }
+    sdl_numframes++;
+    SDL_CondSignal(frame_available);
+    SDL_UnlockMutex(frame_lock);
+
+    take_presentation_requests();
+    wait_for_frame_time();
+}
+
+void render_skipped_frame() {
+    if (!ppu->enable_graphics) {
+        return;
+    }
+    if (threaded_presentation) {
+        take_presentation_requests();
+        wait_for_frame_time();
+        return;
+    }
+    handle_events();
+    // Nothing new to upload, but presenting again still waits on vsync, which is what paces emulation
+    present();
+}
+
+void render_screen(byte* screen, int pitch, uint64_t* dirty_rows) {
+    if (!ppu->enable_graphics) {
+        return;
+    }
+    if (threaded_presentation) {
+        publish_frame(screen, pitch, dirty_rows);
+        return;
+    }
+    handle_events();
+    upload_dirty_rows(screen, pitch, dirty_rows);
+
+    // Still presented when nothing changed, since vsync on present is what paces emulation (unless audio does)
+    present();
+    sdl_numframes++;
+    if (sdl_lastframe < SDL_GetTicks() - fps_interval) {
+        update_fps(sdl_numframes);
+        sdl_numframes = 0;
+    }
+}
+
+void run_presentation_loop(SDL_ThreadFunction emulation) {
+    threaded_presentation = true;
+    frame_lock = SDL_CreateMutex();
+    frame_available = SDL_CreateCond();
+    initialize();
+    // The format is fixed once the texture exists
+    int presented_pitch = GBA_SCREEN_X * pixel_format_size(ppu->pixel_format);
+
+    SDL_Thread* emulation_thread = SDL_CreateThread(emulation, "emulation", NULL);
+    if (!emulation_thread) {
+        logfatal("Unable to start emulation thread: %s", SDL_GetError())
+    }
+
+    while (!should_quit) {
+        handle_events();
+
+        SDL_LockMutex(frame_lock);
+        if (!frame_ready) {
+            SDL_CondWaitTimeout(frame_available, frame_lock, 1000 / 60);
+        }
+        bool new_frame = frame_ready;
+        uint64_t dirty_rows[SCREEN_ROW_MASK_WORDS];
+        if (new_frame) {
+            int shown = display_frame;
+            display_frame = ready_frame;
+            ready_frame = shown;
+            frame_ready = false;
+            memcpy(dirty_rows, pending_dirty_rows, sizeof(dirty_rows));
+            memset(pending_dirty_rows, 0, sizeof(pending_dirty_rows));
+        }
+        uint32_t emulated_frames = sdl_numframes;
+        bool fps_due = sdl_lastframe < SDL_GetTicks() - fps_interval;
+        if (fps_due) {
+            sdl_numframes = 0;
+        }
+        SDL_UnlockMutex(frame_lock);
+
+        if (new_frame) {
+            upload_dirty_rows(frames[display_frame], presented_pitch, dirty_rows);
+        }
+        present();
+        if (fps_due) {
+            update_fps(emulated_frames);
+        }
+    }
+
+    SDL_WaitThread(emulation_thread, NULL);
+}
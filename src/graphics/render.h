@@ -3,9 +3,18 @@
 
 #include <SDL.h>
 #include "ppu.h"
+#include "scaler.h"
 
 void set_screen_scale(int scale);
-void render_screen(color_t (*screen)[GBA_SCREEN_Y][GBA_SCREEN_X]);
+void set_scale_filter(scale_filter_t filter);
+// The audio device paces emulation instead of vsync
+void set_audio_paced(bool paced);
+// Only the rows set in dirty_rows are uploaded, and the bits are cleared once they are
+void render_screen(byte* screen, int pitch, uint64_t* dirty_rows);
+// Keeps handling input and pacing emulation without drawing anything new
+void render_skipped_frame();
+// Runs emulation on its own thread and presents its frames from this one until the user quits
+void run_presentation_loop(SDL_ThreadFunction emulation);
 void gba_handle_event(SDL_Event* event); // Only used so the debug window can send events back
 
 #endif //GBA_RENDER_H
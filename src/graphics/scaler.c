@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "scaler.h"
+#include "../common/log.h"
+
+// Each band of rows is scaled one row at a time. Source rows are widened to words with two pixels of padding on each
+// side, so the kernels never have to clamp, and every kernel writes whole output rows of words that are then narrowed
+// back to the pixel format on the way out.
+
+#define MAX_SCALER_THREADS 4
+// Below this many rows per band, handing work to another thread costs more than it saves
+#define MIN_BAND_ROWS 16
+#define PADDED_ROW (GBA_SCREEN_X + 4)
+
+typedef struct scale_band {
+    const byte* screen;
+    int pitch;
+    pixel_format_t format;
+    int first;
+    int last;
+    byte* dst;
+    int dst_pitch;
+} scale_band_t;
+
+static scale_filter_t filter = SCALE_FILTER_NONE;
+static int factor = 1;
+
+static int num_threads = 0;
+static SDL_Thread* threads[MAX_SCALER_THREADS];
+static SDL_sem* band_queued[MAX_SCALER_THREADS];
+static SDL_sem* band_done = NULL;
+static scale_band_t bands[MAX_SCALER_THREADS];
+static bool stopping = false;
+// Held for the whole of a run, so the threads can't be stopped out from under one. Runs can come from the presentation
+// thread while the emulation thread is cleaning up, and fall back to scaling everything inline once the threads are gone,
+// so this outlives them.
+static SDL_mutex* run_lock = NULL;
+
+int scale_filter_factor(scale_filter_t scale_filter, int screen_scale) {
+    switch (scale_filter) {
+        case SCALE_FILTER_NONE:
+            return 1;
+        case SCALE_FILTER_NEAREST:
+            return screen_scale < 1 ? 1 : screen_scale > MAX_SCALE_FACTOR ? MAX_SCALE_FACTOR : screen_scale;
+        case SCALE_FILTER_SCALE2X:
+        case SCALE_FILTER_XBR:
+            return 2;
+        case SCALE_FILTER_SCALE3X:
+            return 3;
+    }
+    logfatal("Unknown scale filter: %d", scale_filter)
+}
+
+int scale_filter_radius(scale_filter_t scale_filter) {
+    switch (scale_filter) {
+        case SCALE_FILTER_NONE:
+        case SCALE_FILTER_NEAREST:
+            return 0;
+        case SCALE_FILTER_SCALE2X:
+        case SCALE_FILTER_SCALE3X:
+            return 1;
+        case SCALE_FILTER_XBR:
+            return 2;
+    }
+    logfatal("Unknown scale filter: %d", scale_filter)
+}
+
+INLINE void load_row(const byte* screen, int pitch, pixel_format_t format, int y, word* row) {
+    y = y < 0 ? 0 : y >= GBA_SCREEN_Y ? GBA_SCREEN_Y - 1 : y;
+    const byte* src = &screen[y * pitch];
+    if (format == PIXEL_FORMAT_XRGB8888) {
+        memcpy(&row[2], src, GBA_SCREEN_X * sizeof(word));
+    } else {
+        half pixels[GBA_SCREEN_X];
+        memcpy(pixels, src, sizeof(pixels));
+        for (int x = 0; x < GBA_SCREEN_X; x++) {
+            row[x + 2] = pixels[x];
+        }
+    }
+    row[0] = row[1] = row[2];
+    row[GBA_SCREEN_X + 2] = row[GBA_SCREEN_X + 3] = row[GBA_SCREEN_X + 1];
+}
+
+INLINE void store_row(pixel_format_t format, const word* row, int width, byte* dst) {
+    if (format == PIXEL_FORMAT_XRGB8888) {
+        memcpy(dst, row, width * sizeof(word));
+    } else {
+        half* out = (half*)dst;
+        for (int x = 0; x < width; x++) {
+            out[x] = row[x];
+        }
+    }
+}
+
+// Per channel average, the mask drops the low bit of each channel so nothing carries into its neighbor
+INLINE word blend(pixel_format_t format, word a, word b) {
+    word mask = format == PIXEL_FORMAT_XRGB8888 ? 0xFEFEFEFE : format == PIXEL_FORMAT_RGB565 ? 0xF7DE : 0x7BDE;
+    return (a & b) + (((a ^ b) & mask) >> 1);
+}
+
+INLINE void decode_rgb(pixel_format_t format, word c, int* r, int* g, int* b) {
+    switch (format) {
+        case PIXEL_FORMAT_XRGB8888:
+            *r = (c >> 8) & 0xFF;
+            *g = (c >> 16) & 0xFF;
+            *b = (c >> 24) & 0xFF;
+            break;
+        case PIXEL_FORMAT_RGB565:
+            *r = ((c >> 11) & 0x1F) << 3;
+            *g = ((c >> 5) & 0x3F) << 2;
+            *b = (c & 0x1F) << 3;
+            break;
+        default:
+            *r = (c & 0x1F) << 3;
+            *g = ((c >> 5) & 0x1F) << 3;
+            *b = ((c >> 10) & 0x1F) << 3;
+            break;
+    }
+}
+
+// xBR compares every pixel against its neighbors many times over, so each row is converted to YUV once up front
+typedef struct yuv_row {
+    int16_t y[PADDED_ROW];
+    int16_t u[PADDED_ROW];
+    int16_t v[PADDED_ROW];
+} yuv_row_t;
+
+INLINE void load_yuv(pixel_format_t format, const word* row, yuv_row_t* yuv) {
+    for (int x = 0; x < PADDED_ROW; x++) {
+        int r, g, b;
+        decode_rgb(format, row[x], &r, &g, &b);
+        yuv->y[x] = (77 * r + 150 * g + 29 * b) >> 8;
+        yuv->u[x] = (-43 * r - 85 * g + 128 * b) >> 8;
+        yuv->v[x] = (128 * r - 107 * g - 21 * b) >> 8;
+    }
+}
+
+// Weighted YUV difference, luma counts for the most
+INLINE int distance(const yuv_row_t* a, int ax, const yuv_row_t* b, int bx) {
+    return 48 * abs(a->y[ax] - b->y[bx]) + 7 * abs(a->u[ax] - b->u[bx]) + 6 * abs(a->v[ax] - b->v[bx]);
+}
+
+INLINE void scale_nearest(word** rows, word** out) {
+    const word* e = &rows[2][2];
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        for (int i = 0; i < factor; i++) {
+            out[0][x * factor + i] = e[x];
+        }
+    }
+    for (int i = 1; i < factor; i++) {
+        memcpy(out[i], out[0], GBA_SCREEN_X * factor * sizeof(word));
+    }
+}
+
+INLINE void scale_2x(word** rows, word** out) {
+    const word* b = &rows[1][2];
+    const word* e = &rows[2][2];
+    const word* h = &rows[3][2];
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        word B = b[x], D = e[x - 1], E = e[x], F = e[x + 1], H = h[x];
+        bool edge = B != H && D != F;
+        out[0][x * 2 + 0] = edge && D == B ? D : E;
+        out[0][x * 2 + 1] = edge && B == F ? F : E;
+        out[1][x * 2 + 0] = edge && D == H ? D : E;
+        out[1][x * 2 + 1] = edge && H == F ? F : E;
+    }
+}
+
+INLINE void scale_3x(word** rows, word** out) {
+    const word* above = &rows[1][2];
+    const word* e = &rows[2][2];
+    const word* below = &rows[3][2];
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        word A = above[x - 1], B = above[x], C = above[x + 1];
+        word D = e[x - 1],     E = e[x],     F = e[x + 1];
+        word G = below[x - 1], H = below[x], I = below[x + 1];
+        bool edge = B != H && D != F;
+        out[0][x * 3 + 0] = edge && D == B ? D : E;
+        out[0][x * 3 + 1] = edge && ((D == B && E != C) || (B == F && E != A)) ? B : E;
+        out[0][x * 3 + 2] = edge && B == F ? F : E;
+        out[1][x * 3 + 0] = edge && ((D == B && E != G) || (D == H && E != A)) ? D : E;
+        out[1][x * 3 + 1] = E;
+        out[1][x * 3 + 2] = edge && ((B == F && E != I) || (H == F && E != C)) ? F : E;
+        out[2][x * 3 + 0] = edge && D == H ? D : E;
+        out[2][x * 3 + 1] = edge && ((D == H && E != I) || (H == F && E != G)) ? H : E;
+        out[2][x * 3 + 2] = edge && H == F ? F : E;
+    }
+}
+
+// One corner of the xBR 2x kernel, written for the bottom right. sx and sy mirror it onto the other three.
+INLINE word xbr_corner(pixel_format_t format, word** rows, yuv_row_t** yuv, int x, int sx, int sy) {
+#define ROW(dy) (2 + (dy) * sy)
+#define COL(dx) (2 + x + (dx) * sx)
+#define P(dx, dy) rows[ROW(dy)][COL(dx)]
+#define DIST(ax, ay, bx, by) distance(yuv[ROW(ay)], COL(ax), yuv[ROW(by)], COL(bx))
+    word E = P(0, 0), F = P(1, 0), H = P(0, 1);
+    if (E == F || E == H) {
+        return E;
+    }
+
+    // E against C and G, I against F4 and H5, H against F
+    int across = DIST(0, 0, 1, -1) + DIST(0, 0, -1, 1) + DIST(1, 1, 2, 0) + DIST(1, 1, 0, 2) + 4 * DIST(0, 1, 1, 0);
+    // H against D and I5, F against I4 and B, E against I
+    int along = DIST(0, 1, -1, 0) + DIST(0, 1, 1, 2) + DIST(1, 0, 2, 1) + DIST(1, 0, 0, -1) + 4 * DIST(0, 0, 1, 1);
+    if (across >= along) {
+        return E;
+    }
+    word edge = DIST(0, 0, 1, 0) <= DIST(0, 0, 0, 1) ? F : H;
+    return blend(format, E, edge);
+#undef DIST
+#undef P
+#undef COL
+#undef ROW
+}
+
+INLINE void scale_xbr(pixel_format_t format, word** rows, yuv_row_t** yuv, word** out) {
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        out[0][x * 2 + 0] = xbr_corner(format, rows, yuv, x, -1, -1);
+        out[0][x * 2 + 1] = xbr_corner(format, rows, yuv, x, 1, -1);
+        out[1][x * 2 + 0] = xbr_corner(format, rows, yuv, x, -1, 1);
+        out[1][x * 2 + 1] = xbr_corner(format, rows, yuv, x, 1, 1);
+    }
+}
+
+static void scale_band(scale_band_t* band) {
+    word row_data[5][PADDED_ROW];
+    word* rows[5];
+    yuv_row_t yuv_data[5];
+    yuv_row_t* yuv[5];
+    word out_data[MAX_SCALE_FACTOR][GBA_SCREEN_X * MAX_SCALE_FACTOR];
+    word* out[MAX_SCALE_FACTOR];
+    for (int i = 0; i < MAX_SCALE_FACTOR; i++) {
+        out[i] = out_data[i];
+    }
+
+    // rows[2] is always the row being scaled, the others slide along with it
+    for (int i = 0; i < 5; i++) {
+        rows[i] = row_data[i];
+        yuv[i] = &yuv_data[i];
+        load_row(band->screen, band->pitch, band->format, band->first + i - 2, rows[i]);
+        if (filter == SCALE_FILTER_XBR) {
+            load_yuv(band->format, rows[i], yuv[i]);
+        }
+    }
+
+    for (int y = band->first; y < band->last; y++) {
+        if (y > band->first) {
+            word* oldest = rows[0];
+            yuv_row_t* oldest_yuv = yuv[0];
+            memmove(&rows[0], &rows[1], 4 * sizeof(word*));
+            memmove(&yuv[0], &yuv[1], 4 * sizeof(yuv_row_t*));
+            rows[4] = oldest;
+            yuv[4] = oldest_yuv;
+            load_row(band->screen, band->pitch, band->format, y + 2, rows[4]);
+            if (filter == SCALE_FILTER_XBR) {
+                load_yuv(band->format, rows[4], yuv[4]);
+            }
+        }
+
+        switch (filter) {
+            case SCALE_FILTER_NONE:
+            case SCALE_FILTER_NEAREST:
+                scale_nearest(rows, out);
+                break;
+            case SCALE_FILTER_SCALE2X:
+                scale_2x(rows, out);
+                break;
+            case SCALE_FILTER_SCALE3X:
+                scale_3x(rows, out);
+                break;
+            case SCALE_FILTER_XBR:
+                scale_xbr(band->format, rows, yuv, out);
+                break;
+        }
+
+        byte* dst = band->dst + (y - band->first) * factor * band->dst_pitch;
+        for (int i = 0; i < factor; i++) {
+            store_row(band->format, out[i], GBA_SCREEN_X * factor, dst + i * band->dst_pitch);
+        }
+    }
+}
+
+static int scaler_thread_main(void* data) {
+    int index = (int)(intptr_t)data;
+    while (SDL_SemWait(band_queued[index]) == 0) {
+        if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        scale_band(&bands[index + 1]);
+        SDL_SemPost(band_done);
+    }
+    return 0;
+}
+
+void scaler_init(scale_filter_t scale_filter, int screen_scale) {
+    filter = scale_filter;
+    factor = scale_filter_factor(scale_filter, screen_scale);
+    if (filter == SCALE_FILTER_NONE || num_threads > 0) {
+        return;
+    }
+
+    // The calling thread takes a band too
+    int cpus = SDL_GetCPUCount();
+    num_threads = (cpus > MAX_SCALER_THREADS ? MAX_SCALER_THREADS : cpus) - 1;
+    if (num_threads < 0) {
+        num_threads = 0;
+    }
+    if (!run_lock) {
+        run_lock = SDL_CreateMutex();
+    }
+    stopping = false;
+    band_done = SDL_CreateSemaphore(0);
+    for (int i = 0; i < num_threads; i++) {
+        band_queued[i] = SDL_CreateSemaphore(0);
+        threads[i] = SDL_CreateThread(scaler_thread_main, "scaler", (void*)(intptr_t)i);
+        if (!threads[i]) {
+            logfatal("Unable to start scaler thread: %s", SDL_GetError())
+        }
+    }
+}
+
+void scaler_stop() {
+    if (!band_done) {
+        return;
+    }
+
+    SDL_LockMutex(run_lock);
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < num_threads; i++) {
+        SDL_SemPost(band_queued[i]);
+        SDL_WaitThread(threads[i], NULL);
+        SDL_DestroySemaphore(band_queued[i]);
+        threads[i] = NULL;
+        band_queued[i] = NULL;
+    }
+    num_threads = 0;
+    SDL_DestroySemaphore(band_done);
+    band_done = NULL;
+    SDL_UnlockMutex(run_lock);
+}
+
+void scaler_run(const byte* screen, int pitch, pixel_format_t format, int first, int last, byte* dst, int dst_pitch) {
+    if (run_lock) {
+        SDL_LockMutex(run_lock);
+    }
+    int rows = last - first;
+    int num_bands = rows / MIN_BAND_ROWS;
+    if (num_bands > num_threads + 1) {
+        num_bands = num_threads + 1;
+    }
+    if (num_bands < 1) {
+        num_bands = 1;
+    }
+
+    for (int i = 0; i < num_bands; i++) {
+        scale_band_t* band = &bands[i];
+        band->screen = screen;
+        band->pitch = pitch;
+        band->format = format;
+        band->first = first + rows * i / num_bands;
+        band->last = first + rows * (i + 1) / num_bands;
+        band->dst = dst + (band->first - first) * factor * dst_pitch;
+        band->dst_pitch = dst_pitch;
+    }
+
+    for (int i = 1; i < num_bands; i++) {
+        SDL_SemPost(band_queued[i - 1]);
+    }
+    scale_band(&bands[0]);
+    for (int i = 1; i < num_bands; i++) {
+        SDL_SemWait(band_done);
+    }
+    if (run_lock) {
+        SDL_UnlockMutex(run_lock);
+    }
+}
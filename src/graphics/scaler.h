@@ -0,0 +1,28 @@
+#ifndef GBA_SCALER_H
+#define GBA_SCALER_H
+
+#include "ppu.h"
+
+#define MAX_SCALE_FACTOR 8
+
+typedef enum scale_filter {
+    SCALE_FILTER_NONE,    // Leave scaling to the SDL renderer
+    SCALE_FILTER_NEAREST, // Integer nearest neighbor, to the full window scale
+    SCALE_FILTER_SCALE2X,
+    SCALE_FILTER_SCALE3X,
+    SCALE_FILTER_XBR      // 2x, edge directed with blended corners
+} scale_filter_t;
+
+// How many output pixels each screen pixel becomes, in each direction
+int scale_filter_factor(scale_filter_t filter, int screen_scale);
+// How many rows above and below a screen row can affect that row's output
+int scale_filter_radius(scale_filter_t filter);
+
+void scaler_init(scale_filter_t filter, int screen_scale);
+// Joins the band threads. Anything scaled after this runs entirely on the calling thread.
+void scaler_stop();
+// Scales screen rows [first, last) into dst, which points at the output row for screen row first.
+// Large spans are split into bands of rows and run on the scaler threads.
+void scaler_run(const byte* screen, int pitch, pixel_format_t format, int first, int last, byte* dst, int dst_pitch);
+
+#endif //GBA_SCALER_H
@@ -0,0 +1,95 @@
+#include "shm_export.h"
+#include "../common/log.h"
+
+#ifndef MinGW
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+static shm_export_header_t* header = NULL;
+static size_t mapping_size = 0;
+static char* shm_name = NULL;
+
+void shm_export_start(const char* name, gba_ppu_t* ppu) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        logfatal("Unable to open shared memory %s", name)
+    }
+
+    size_t slots_offset = (sizeof(shm_export_header_t) + 63) & ~63;
+    mapping_size = slots_offset + SHM_EXPORT_SLOTS * SCREEN_BUFFER_SIZE;
+    if (ftruncate(fd, mapping_size) < 0) {
+        logfatal("Unable to size shared memory %s", name)
+    }
+
+    header = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        header = NULL;
+        logfatal("Unable to map shared memory %s", name)
+    }
+    shm_name = strdup(name);
+
+    memset(header, 0, sizeof(shm_export_header_t));
+    header->version = SHM_EXPORT_VERSION;
+    header->width = GBA_SCREEN_X;
+    header->height = GBA_SCREEN_Y;
+    header->pitch = ppu->screen_pitch;
+    header->pixel_format = ppu->pixel_format;
+    header->num_slots = SHM_EXPORT_SLOTS;
+    header->slot_size = SCREEN_BUFFER_SIZE;
+    header->slots_offset = slots_offset;
+    // Readers check the magic last, so they never see a half initialized header
+    __atomic_store_n(&header->magic, SHM_EXPORT_MAGIC, __ATOMIC_RELEASE);
+    loginfo("Exporting frames to shared memory %s", name)
+}
+
+void shm_export_stop() {
+    if (!header) {
+        return;
+    }
+    munmap(header, mapping_size);
+    header = NULL;
+    shm_unlink(shm_name);
+    free(shm_name);
+    shm_name = NULL;
+}
+
+void shm_export_frame(const byte* screen, int pitch, pixel_format_t format) {
+    if (!header) {
+        return;
+    }
+
+    uint32_t frame = header->frame_seq;
+    int slot = frame % SHM_EXPORT_SLOTS;
+    byte* dest = (byte*)header + header->slots_offset + slot * header->slot_size;
+
+    __atomic_store_n(&header->slot_seq[slot], 2 * frame + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(dest, screen, header->pitch * GBA_SCREEN_Y);
+    __atomic_store_n(&header->slot_seq[slot], 2 * frame + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->frame_seq, frame + 1, __ATOMIC_RELEASE);
+
+#ifdef __linux__
+    syscall(SYS_futex, &header->frame_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+#else
+
+void shm_export_start(const char* name, gba_ppu_t* ppu) {
+    logfatal("Shared memory frame export isn't supported on this platform")
+}
+
+void shm_export_stop() {}
+
+void shm_export_frame(const byte* screen, int pitch, pixel_format_t format) {}
+
+#endif
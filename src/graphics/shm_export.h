@@ -0,0 +1,36 @@
+#ifndef GBA_SHM_EXPORT_H
+#define GBA_SHM_EXPORT_H
+
+#include <stdint.h>
+#include "ppu.h"
+
+// Headless frame export. Every frame is copied into a ring of slots in a POSIX shared memory object, where
+// any number of reader processes can map it and read frames in place.
+//
+// Readers wait for frame_seq to change (on Linux, with FUTEX_WAIT on its address), then read the newest frame out of
+// slot (frame_seq - 1) % num_slots. Frame n is complete while slot_seq for its slot reads 2 * n + 2, it is odd while
+// the slot is being rewritten. Checking slot_seq before and after reading a frame tells a reader it wasn't torn.
+
+#define SHM_EXPORT_MAGIC 0x46424744 // "DGBF"
+#define SHM_EXPORT_VERSION 1
+#define SHM_EXPORT_SLOTS 4
+
+typedef struct shm_export_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t pixel_format; // pixel_format_t
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint32_t slots_offset; // Slot n starts at slots_offset + n * slot_size from the start of the mapping
+    uint32_t frame_seq;    // Number of frames published so far
+    uint32_t slot_seq[SHM_EXPORT_SLOTS];
+} shm_export_header_t;
+
+void shm_export_start(const char* name, gba_ppu_t* ppu);
+void shm_export_stop();
+void shm_export_frame(const byte* screen, int pitch, pixel_format_t format);
+
+#endif //GBA_SHM_EXPORT_H
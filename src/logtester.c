@@ -84,6 +84,7 @@ int main(int argc, char** argv) {
     log_set_verbosity(0);
 
     init_gbasystem(rom, NULL, false);
+    set_render_policy(RENDER_NEVER, 0);
 
     set_register(cpu, 0, 0x00000000);
     set_register(cpu, 1, 0x00000000);
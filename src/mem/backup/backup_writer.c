@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#ifdef MinGW
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "backup_writer.h"
+#include "../../common/log.h"
+
+// The emulation thread never touches the save file. A flush copies the dirty blocks into a staging copy of the backup
+// and wakes the writer, which takes them out from under the lock before doing any IO. Flushes that land while it's
+// still writing are folded into its next batch.
+
+static SDL_Thread* writer_thread = NULL;
+static SDL_sem* work_available = NULL;
+static SDL_mutex* staging_lock = NULL;
+
+// Under staging_lock
+static byte* staging = NULL;
+static uint64_t staged_blocks[BACKUP_MAX_BLOCKS / 64];
+static bool stopping = false;
+
+// Only touched by the writer
+static byte* writing = NULL;
+static FILE* fp = NULL;
+
+static const char* path = NULL;
+static size_t size = 0;
+static word block_size = 0;
+
+INLINE int block_count() {
+    return (int)((size + block_size - 1) / block_size);
+}
+
+INLINE bool block_set(const uint64_t* blocks, int block) {
+    return (blocks[block / 64] >> (block % 64)) & 1;
+}
+
+static void write_blocks(const uint64_t* blocks) {
+    // The file is started over the first time, or again after failing to open it. Either way, all of the backup has
+    // been through staging by then.
+    bool everything = false;
+    if (!fp) {
+        fp = fopen(path, "wb");
+        if (!fp) {
+            logwarn("Unable to open %s to save the backup", path)
+            return;
+        }
+        everything = true;
+    }
+
+    bool wrote = false;
+    int blocks_total = block_count();
+    for (int block = 0; block < blocks_total; block++) {
+        if (!everything && !block_set(blocks, block)) {
+            continue;
+        }
+        // Runs of dirty blocks go out in one write
+        int end = block + 1;
+        while (end < blocks_total && (everything || block_set(blocks, end))) {
+            end++;
+        }
+        size_t offset = (size_t)block * block_size;
+        size_t length = (size_t)end * block_size < size ? (size_t)end * block_size - offset : size - offset;
+        fseek(fp, (long)offset, SEEK_SET);
+        fwrite(writing + offset, length, 1, fp);
+        wrote = true;
+        block = end;
+    }
+
+    if (wrote) {
+        fflush(fp);
+#ifdef MinGW
+        _commit(_fileno(fp));
+#else
+        fsync(fileno(fp));
+#endif
+    }
+}
+
+static int backup_writer_main(void* data) {
+    uint64_t blocks[BACKUP_MAX_BLOCKS / 64];
+    while (true) {
+        SDL_SemWait(work_available);
+
+        SDL_LockMutex(staging_lock);
+        memcpy(blocks, staged_blocks, sizeof(blocks));
+        memset(staged_blocks, 0, sizeof(staged_blocks));
+        for (int block = 0; block < block_count(); block++) {
+            if (block_set(blocks, block)) {
+                size_t offset = (size_t)block * block_size;
+                size_t length = offset + block_size < size ? block_size : size - offset;
+                memcpy(writing + offset, staging + offset, length);
+            }
+        }
+        bool stop = stopping;
+        SDL_UnlockMutex(staging_lock);
+
+        write_blocks(blocks);
+        if (stop) {
+            return 0;
+        }
+    }
+}
+
+static void backup_writer_start(gbamem_t* mem) {
+    path = mem->backup_path;
+    size = mem->backup_size;
+    block_size = backup_block_size(mem);
+    staging = malloc(size);
+    writing = malloc(size);
+    memset(staged_blocks, 0, sizeof(staged_blocks));
+    stopping = false;
+    fp = NULL;
+
+    // Nothing's been written to the file yet, all of it goes out with the first flush
+    for (int block = 0; block < block_count(); block++) {
+        mem->backup_dirty_blocks[block / 64] |= 1ull << (block % 64);
+    }
+
+    work_available = SDL_CreateSemaphore(0);
+    staging_lock = SDL_CreateMutex();
+    writer_thread = SDL_CreateThread(backup_writer_main, "backup", NULL);
+    if (!writer_thread) {
+        logfatal("Unable to start backup writer thread: %s", SDL_GetError())
+    }
+}
+
+void backup_writer_flush(gbamem_t* mem) {
+    bool any_dirty = false;
+    for (int i = 0; i < BACKUP_MAX_BLOCKS / 64; i++) {
+        any_dirty |= mem->backup_dirty_blocks[i] != 0;
+    }
+    if (!any_dirty) {
+        return;
+    }
+
+    if (!writer_thread) {
+        backup_writer_start(mem);
+    }
+
+    SDL_LockMutex(staging_lock);
+    for (int block = 0; block < block_count(); block++) {
+        if (block_set(mem->backup_dirty_blocks, block)) {
+            size_t offset = (size_t)block * block_size;
+            size_t length = offset + block_size < size ? block_size : size - offset;
+            memcpy(staging + offset, mem->backup + offset, length);
+            staged_blocks[block / 64] |= 1ull << (block % 64);
+        }
+    }
+    SDL_UnlockMutex(staging_lock);
+    memset(mem->backup_dirty_blocks, 0, sizeof(mem->backup_dirty_blocks));
+    SDL_SemPost(work_available);
+}
+
+void backup_writer_stop() {
+    if (!writer_thread) {
+        return;
+    }
+
+    SDL_LockMutex(staging_lock);
+    stopping = true;
+    SDL_UnlockMutex(staging_lock);
+    SDL_SemPost(work_available);
+    SDL_WaitThread(writer_thread, NULL);
+    writer_thread = NULL;
+
+    if (fp) {
+        fclose(fp);
+        fp = NULL;
+    }
+    SDL_DestroySemaphore(work_available);
+    SDL_DestroyMutex(staging_lock);
+    free(staging);
+    staging = NULL;
+    free(writing);
+    writing = NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef GBA_BACKUP_WRITER_H
+#define GBA_BACKUP_WRITER_H
+
+#include "../gbamem.h"
+
+// Persists the backup from a thread of its own. A flush only copies the blocks marked dirty since the last one, the
+// writer then rewrites just those parts of the save file and syncs it once for the whole batch. The first flush writes
+// the entire file, since whatever's there may not exist yet or be a different size.
+void backup_writer_flush(gbamem_t* mem);
+// Waits for everything flushed so far to hit the disk
+void backup_writer_stop();
+
+#endif //GBA_BACKUP_WRITER_H
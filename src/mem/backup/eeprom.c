@@ -44,6 +44,40 @@ void handle_eeprom_command(gbamem_t* mem, byte command) {
     }
 }
 
+// The size isn't known until the first transfer, which has to be a full command: its length gives away the address width
+void init_eeprom_from_dma(int active_dma, gbabus_t* bus, gbamem_t* mem) {
+    int wc;
+    switch (active_dma) {
+        case 0:
+            wc = bus->DMA0CNT_L.wc;
+            break;
+        case 1:
+            wc = bus->DMA1CNT_L.wc;
+            break;
+        case 2:
+            wc = bus->DMA2CNT_L.wc;
+            break;
+        case 3:
+            wc = bus->DMA3CNT_L.wc;
+            break;
+    }
+
+    switch (wc) {
+        case 9: // 9 bits = 2 for command, 6 for address, 1 to end command
+            if (!mem->eeprom_initialized) {
+                init_eeprom(mem, EEPROM_512);
+            }
+            break;
+        case 17: // 17 bits = 2 for command, 14 for address, 1 to end command
+            if (!mem->eeprom_initialized) {
+                init_eeprom(mem, EEPROM_8K);
+            }
+            break;
+        default:
+            logfatal("Write to EEPROM with active DMA %d and a WC of %d", active_dma, wc)
+    }
+}
+
 half read_half_eeprom(gbabus_t* bus, gbamem_t* mem, word address) {
     if (!mem->eeprom_initialized) {
         logfatal("Read from EEPROM before initialized!")
@@ -87,36 +121,7 @@ half read_half_eeprom(gbabus_t* bus, gbamem_t* mem, word address) {
 
 void write_half_eeprom(int active_dma, gbabus_t* bus, gbamem_t* mem, word address, half value) {
     if (!mem->eeprom_initialized) {
-        int wc;
-        switch (active_dma) {
-            case 0:
-                wc = bus->DMA0CNT_L.wc;
-                break;
-            case 1:
-                wc = bus->DMA1CNT_L.wc;
-                break;
-            case 2:
-                wc = bus->DMA2CNT_L.wc;
-                break;
-            case 3:
-                wc = bus->DMA3CNT_L.wc;
-                break;
-        }
-
-        switch (wc) {
-            case 9: // 9 bits = 2 for command, 6 for address, 1 to end command
-                if (!mem->eeprom_initialized) {
-                    init_eeprom(mem, EEPROM_512);
-                }
-                break;
-            case 17: // 17 bits = 2 for command, 14 for address, 1 to end command
-                if (!mem->eeprom_initialized) {
-                    init_eeprom(mem, EEPROM_8K);
-                }
-                break;
-            default:
-                logfatal("Write to EEPROM with active DMA %d and a WC of %d", active_dma, wc)
-        }
+        init_eeprom_from_dma(active_dma, bus, mem);
     }
 
     switch (mem->eeprom_state) {
@@ -174,7 +179,7 @@ void write_half_eeprom(int active_dma, gbabus_t* bus, gbamem_t* mem, word addres
                     logfatal("Access to EEPROM outside backup space! Index: %d Backup size: %zu", index, mem->backup_size)
                 }
                 mem->backup[index] = eeprom_value;
-                mem->backup_dirty = true;
+                mark_backup_dirty(mem, index, sizeof(byte));
                 logwarn("Wrote bit %d to bit number %d in byte offset: %d. Old value: 0x%02X New value: 0x%02X",
                         value & 1, bit_in_byte, byte_offset, old_value, eeprom_value);
             } else if (mem->eeprom_bits_remaining == 0) {
@@ -195,3 +200,82 @@ void write_half_eeprom(int active_dma, gbabus_t* bus, gbamem_t* mem, word addres
             logfatal("Write half 0x%04X to EEPROM in unknown state: %d at addr 0x%08X", value, mem->eeprom_state, address)
     }
 }
+
+INLINE half eeprom_bits(const byte* source, int first, int count) {
+    half value = 0;
+    for (int i = first; i < first + count; i++) {
+        value = (value << 1) | (source[i * sizeof(half)] & 1);
+    }
+    return value;
+}
+
+void write_eeprom_frame(int active_dma, gbabus_t* bus, gbamem_t* mem, word address, const byte* source, word count) {
+    if (!mem->eeprom_initialized) {
+        init_eeprom_from_dma(active_dma, bus, mem);
+    }
+    int address_bits = mem->backup_size == EEPROM8K_SIZE ? 14 : 6;
+    byte command = eeprom_bits(source, 0, 2);
+    word frame_length = 2 + address_bits + 1;
+    if (command == EEPROM_COMMAND_WRITE) {
+        frame_length += 64;
+    }
+
+    if (mem->eeprom_state != EEPROM_READY || count != frame_length
+        || (command != EEPROM_COMMAND_READ && command != EEPROM_COMMAND_WRITE)) {
+        for (word i = 0; i < count; i++) {
+            write_half_eeprom(active_dma, bus, mem, address, half_from_byte_array((byte*)source, i * sizeof(half)));
+        }
+        return;
+    }
+
+    mem->eeprom_command = command;
+    mem->eeprom_address = eeprom_bits(source, 2, address_bits);
+    mem->eeprom_address <<= 3; // Addresses are in 8 byte blocks
+    int end_bit = source[(frame_length - 1) * sizeof(half)] & 1;
+
+    if (command == EEPROM_COMMAND_READ) {
+        if (end_bit != 0) {
+            logwarn("Expected a value with an LSB of 0 here, got %d", end_bit)
+        }
+        logwarn("Reading 64 bits from EEPROM starting at address: 0x%04X", mem->eeprom_address)
+        mem->eeprom_state = EEPROM_READ;
+        mem->eeprom_bits_remaining = 64 + 4; // Plus 4 garbage bits
+    } else {
+        if (mem->eeprom_address + 8 > mem->backup_size) {
+            logfatal("Access to EEPROM outside backup space! Index: %d Backup size: %zu", mem->eeprom_address, mem->backup_size)
+        }
+        logwarn("Writing 64 bits to EEPROM starting at address: 0x%04X", mem->eeprom_address)
+        for (int i = 0; i < 8; i++) {
+            mem->backup[mem->eeprom_address + i] = eeprom_bits(source, 2 + address_bits + i * 8, 8);
+        }
+        mark_backup_dirty(mem, mem->eeprom_address, EEPROM_BLOCK_SIZE);
+        if (end_bit != 0) {
+            logfatal("Expected a write with an LSB of 0 after an EEPROM write stream, instead, got: %d", end_bit)
+        }
+        // The bit by bit path counts the end bit off as well
+        mem->eeprom_bits_remaining = EEPROM_READS_UNTIL_READY - 1;
+        mem->eeprom_state = EEPROM_POST_WRITE;
+        logwarn("EEPROM write stream completed.")
+    }
+}
+
+void read_eeprom_frame(gbabus_t* bus, gbamem_t* mem, word address, byte* dest, word count) {
+    if (!mem->eeprom_initialized || mem->eeprom_state != EEPROM_READ || mem->eeprom_bits_remaining != 64 + 4
+        || count != 64 + 4) {
+        for (word i = 0; i < count; i++) {
+            half_to_byte_array(dest, i * sizeof(half), read_half_eeprom(bus, mem, address));
+        }
+        return;
+    }
+
+    if (mem->eeprom_address + 8 > mem->backup_size) {
+        logfatal("Access to EEPROM outside backup space! Index: %d Backup size: %zu", mem->eeprom_address, mem->backup_size)
+    }
+    memset(dest, 0, 4 * sizeof(half)); // Garbage bits
+    for (int bit = 0; bit < 64; bit++) {
+        byte value = mem->backup[mem->eeprom_address + bit / 8];
+        half_to_byte_array(dest, (4 + bit) * sizeof(half), (value >> (7 - (bit % 8))) & 1); // MSB first
+    }
+    mem->eeprom_bits_remaining = 0;
+    mem->eeprom_state = EEPROM_READY;
+}
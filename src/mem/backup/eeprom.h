@@ -11,4 +11,8 @@ typedef enum eeprom_size {
 
 half read_half_eeprom(gbabus_t* bus, gbamem_t* mem, word address);
 void write_half_eeprom(int active_dma, gbabus_t* bus, gbamem_t* mem, word address, half value);
+// A whole DMA transfer at once, count halves from/to plain memory. A full command, address and data frame is decoded in
+// one go; anything else is fed through the bit at a time path above.
+void write_eeprom_frame(int active_dma, gbabus_t* bus, gbamem_t* mem, word address, const byte* source, word count);
+void read_eeprom_frame(gbabus_t* bus, gbamem_t* mem, word address, byte* dest, word count);
 #endif //GBA_EEPROM_H
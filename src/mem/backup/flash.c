@@ -155,7 +155,7 @@ void write_byte_flash(gbamem_t* mem, gbabus_t* bus, word address, byte value) {
                 memset(mem->backup, 0xFF, mem->backup_size);
                 bus->ime_temp.raw = bus->interrupt_master_enable.raw;
                 bus->interrupt_master_enable.enable = false;
-                mem->backup_dirty = true;
+                mark_backup_dirty(mem, 0, mem->backup_size);
             } else {
 #ifdef FLASH_VERBOSE_LOG
                 printf("FLASHC_ERASE_BLOCK\n");
@@ -168,7 +168,7 @@ void write_byte_flash(gbamem_t* mem, gbabus_t* bus, word address, byte value) {
                     unimplemented(index >= mem->backup_size, "Out of bounds access to backup!")
                     mem->backup[index] = 0xFF;
                 }
-                mem->backup_dirty = true;
+                mark_backup_dirty(mem, start + (bus->backup_type == FLASH128K ? mem->flash_bank * 0xFFFF : 0), 0x1000);
             }
             // The games are told to wait until a given value == 0xFF
             // Since we're erasing by overwriting with 0xFFs, we can just go back into FLASH_READY mode
@@ -192,7 +192,7 @@ void write_byte_flash(gbamem_t* mem, gbabus_t* bus, word address, byte value) {
                 mem->flash_erase_write_sector_first_address = 0;
                 mem->flash_state = FLASH_READY;
             }
-            mem->backup_dirty = true;
+            mark_backup_dirty(mem, index, sizeof(byte));
             break;
         }
         case FLASH_WRITE_SINGLE_BYTE: {
@@ -202,7 +202,7 @@ void write_byte_flash(gbamem_t* mem, gbabus_t* bus, word address, byte value) {
             }
             mem->backup[index] = value;
             mem->flash_state = FLASH_READY;
-            mem->backup_dirty = true;
+            mark_backup_dirty(mem, index, sizeof(byte));
             break;
         }
         case FLASH_BANKSWITCH:
@@ -1,6 +1,9 @@
+#include <string.h>
+
 #include "dma.h"
 #include "../gba_system.h"
 #include "ioreg_names.h"
+#include "backup/eeprom.h"
 
 static dma_start_time_t dma_trigger = Immediately;
 
@@ -16,9 +19,165 @@ void dma_start_trigger(dma_start_time_t trigger) {
     gba_dma();
 }
 
+INLINE void dma_end(int n, DMACNTH_t* cnth, DMAINT_t* dmaint) {
+    if (cnth->irq_on_end_of_wc) {
+        switch (n) {
+            case 0:
+                request_interrupt(IRQ_DMA0);
+                break;
+            case 1:
+                request_interrupt(IRQ_DMA1);
+                break;
+            case 2:
+                request_interrupt(IRQ_DMA2);
+                break;
+            case 3:
+                request_interrupt(IRQ_DMA3);
+                break;
+        }
+    }
+    cnth->dma_enable = (cnth->dma_start_time != Immediately) && cnth->dma_repeat;
+    dmaint->previously_enabled = cnth->dma_enable;
+}
+
+// Sound DMA always moves four words, whatever the count and transfer size are set to, and never moves the destination.
+// They go straight into the FIFO instead of through the bus and the FIFO register, and when the source is plain memory
+// counting up (it always is, in practice) they're copied from it in one go. Waitstates are charged the same either way.
+INLINE void sound_dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, int fifo_index) {
+    bus->current_active_dma = n;
+    byte data[SOUND_DMA_BYTES];
+    word source = dmaint->current_source_address & ~(sizeof(word) - 1);
+    word dest = dmaint->current_dest_address;
+    bool increment = cnth->source_addr_control == 0 || cnth->source_addr_control == 3;
+    const byte* direct = increment ? gba_direct_read_ptr(source, SOUND_DMA_BYTES) : NULL;
+
+    if (direct) {
+        memcpy(data, direct, SOUND_DMA_BYTES);
+        gba_tick_burst(source, sizeof(word), SOUND_DMA_BYTES / sizeof(word));
+        dmaint->current_source_address = source + SOUND_DMA_BYTES;
+    } else {
+        for (int i = 0; i < SOUND_DMA_BYTES; i += sizeof(word)) {
+            access_type_t access = i == 0 ? ACCESS_NONSEQUENTIAL : ACCESS_SEQUENTIAL;
+            word_to_byte_array(data, i, gba_read_word(dmaint->current_source_address, access));
+            switch (cnth->source_addr_control) {
+                case 0:
+                case 3: dmaint->current_source_address += sizeof(word); break;
+                case 1: dmaint->current_source_address -= sizeof(word); break;
+                case 2: break; // No change
+                default: logfatal("Unimplemented source address control type: %d", cnth->source_addr_control)
+            }
+        }
+    }
+    gba_tick_burst(dest, sizeof(word), SOUND_DMA_BYTES / sizeof(word));
+    fill_fifo(apu, fifo_index, data, SOUND_DMA_BYTES);
+}
+
+// Charges for, and steps the addresses past, a whole transfer's worth of elements that didn't go through the bus
+INLINE void burst_done(DMAINT_t* dmaint, word source, word dest, word size, bool source_moves, bool dest_moves) {
+    word count = dmaint->remaining;
+    gba_tick_burst(source, size, count);
+    gba_tick_burst(dest, size, count);
+    if (source_moves) {
+        dmaint->current_source_address += count * size;
+    }
+    if (dest_moves) {
+        dmaint->current_dest_address += count * size;
+    }
+    dmaint->remaining = 0;
+}
+
+// Plain memory to plain memory, with both addresses counting up or staying put, is done on host pointers in one go: a
+// memmove, a fill from a fixed source, or just the last element for a fixed destination. IO, the backup, the BIOS,
+// decrementing addresses, transfers running off the end of a region, and overlaps that a forward element-by-element
+// copy would smear are all left to the element loop. Returns whether it did the transfer.
+INLINE bool bulk_dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint) {
+    bool source_moves = cnth->source_addr_control == 0;
+    bool dest_moves = cnth->dest_addr_control == 0 || cnth->dest_addr_control == 3;
+    if ((!source_moves && cnth->source_addr_control != 2) || (!dest_moves && cnth->dest_addr_control != 2)) {
+        return false;
+    }
+
+    word size = cnth->dma_transfer_type ? sizeof(word) : sizeof(half);
+    word count = dmaint->remaining;
+    word source = dmaint->current_source_address & ~(size - 1);
+    word dest = dmaint->current_dest_address & ~(size - 1);
+    word source_length = source_moves ? count * size : size;
+    word dest_length = dest_moves ? count * size : size;
+
+    const byte* from = gba_direct_read_ptr(source, source_length);
+    if (!from) {
+        return false;
+    }
+    byte* to = gba_direct_write_ptr(dest, dest_length);
+    if (!to) {
+        return false;
+    }
+    uintptr_t from_start = (uintptr_t)from;
+    uintptr_t to_start = (uintptr_t)to;
+    bool overlap = from_start < to_start + dest_length && to_start < from_start + source_length;
+    if (overlap && !(source_moves && dest_moves && to_start <= from_start)) {
+        return false;
+    }
+
+    bus->current_active_dma = n;
+    if (source_moves && dest_moves) {
+        memmove(to, from, count * size);
+    } else if (dest_moves) {
+        for (word i = 0; i < count; i++) {
+            memcpy(to + i * size, from, size);
+        }
+    } else {
+        memcpy(to, from + source_length - size, size);
+    }
+    gba_direct_written(dest, dest_length);
+    burst_done(dmaint, source, dest, size, source_moves, dest_moves);
+    return true;
+}
+
+// EEPROMs are only talked to through DMA, and a transfer is always a whole frame, a bit per halfword: command and
+// address (plus the data, to write) one way, or the data the other. Those go to the EEPROM in one call.
+INLINE bool eeprom_dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint) {
+    if (bus->backup_type != EEPROM || cnth->dma_transfer_type != 0) {
+        return false;
+    }
+    bool source_moves = cnth->source_addr_control == 0;
+    bool dest_moves = cnth->dest_addr_control == 0 || cnth->dest_addr_control == 3;
+    if ((!source_moves && cnth->source_addr_control != 2) || (!dest_moves && cnth->dest_addr_control != 2)) {
+        return false;
+    }
+
+    word count = dmaint->remaining;
+    word source = dmaint->current_source_address & ~(sizeof(half) - 1);
+    word dest = dmaint->current_dest_address & ~(sizeof(half) - 1);
+    word source_length = source_moves ? count * sizeof(half) : sizeof(half);
+    word dest_length = dest_moves ? count * sizeof(half) : sizeof(half);
+
+    if (gba_is_eeprom(dest, dest_length)) {
+        const byte* from = source_moves ? gba_direct_read_ptr(source, source_length) : NULL;
+        if (!from) {
+            return false;
+        }
+        bus->current_active_dma = n;
+        write_eeprom_frame(n, bus, mem, dest, from, count);
+    } else if (gba_is_eeprom(source, source_length)) {
+        byte* to = dest_moves ? gba_direct_write_ptr(dest, dest_length) : NULL;
+        if (!to) {
+            return false;
+        }
+        bus->current_active_dma = n;
+        read_eeprom_frame(bus, mem, source, to, count);
+        gba_direct_written(dest, dest_length);
+    } else {
+        return false;
+    }
+    burst_done(dmaint, source, dest, sizeof(half), source_moves, dest_moves);
+    return true;
+}
+
 INLINE int dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, word sad, word dad, word wc, word max_wc) {
     int dma_cycles = 0;
     bool is_sound_dma = false;
+    int fifo_index = 0;
     access_type_t access = ACCESS_NONSEQUENTIAL;
     if (cnth->dma_enable) {
         unimplemented(cnth->game_pak_drq_dma3_only, "Game pak DRQ")
@@ -28,7 +187,6 @@ INLINE int dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, word sad, word dad, wor
                     logfatal("Special start time for DMA0 is invalid!")
                 }
                 else if (n == 1 || n == 2) {
-                    int fifo_index = 0;
 #ifndef ENABLE_AUDIO
                     return 0;
 #endif
@@ -65,7 +223,13 @@ INLINE int dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, word sad, word dad, wor
             dmaint->current_dest_address = dad;
         }
 
-        dmaint->remaining = is_sound_dma ? 4 : wc;
+        if (is_sound_dma) {
+            sound_dma(n, cnth, dmaint, fifo_index);
+            dma_end(n, cnth, dmaint);
+            return 1;
+        }
+
+        dmaint->remaining = wc;
         if (dmaint->remaining == 0) {
             dmaint->remaining = max_wc;
         }
@@ -77,6 +241,10 @@ INLINE int dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, word sad, word dad, wor
                 cnth->source_addr_control, cnth->dest_addr_control)
         logwarn("DMA%dCNT_H set to 0x%08X", n, cnth->raw);
 
+        if (eeprom_dma(n, cnth, dmaint) || bulk_dma(n, cnth, dmaint)) {
+            logwarn("DMA%d: transferred in one go", n)
+        }
+
         while (dmaint->remaining > 0) {
             bus->current_active_dma = n;
             if (cnth->dma_transfer_type == 0) {// 16 bits
@@ -134,24 +302,7 @@ INLINE int dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, word sad, word dad, wor
             dmaint->remaining--;
         }
         logwarn("DMA%d finished", n)
-        if (cnth->irq_on_end_of_wc) {
-            switch (n) {
-                case 0:
-                    request_interrupt(IRQ_DMA0);
-                    break;
-                case 1:
-                    request_interrupt(IRQ_DMA1);
-                    break;
-                case 2:
-                    request_interrupt(IRQ_DMA2);
-                    break;
-                case 3:
-                    request_interrupt(IRQ_DMA3);
-                    break;
-            }
-        }
-        cnth->dma_enable = (cnth->dma_start_time != Immediately) && cnth->dma_repeat;
-        dmaint->previously_enabled = cnth->dma_enable;
+        dma_end(n, cnth, dmaint);
     }
     return dma_cycles;
 }
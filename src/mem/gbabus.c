@@ -115,7 +115,6 @@ gbabus_t* init_gbabus() {
     bus_state->interrupt_master_enable.raw = 0;
     bus_state->interrupt_enable.raw = 0;
     bus_state->KEYINPUT.raw = 0x03FF;
-    bus_state->SOUNDBIAS.raw = 0x0200;
 
     bus_state->DMA0INT.previously_enabled = false;
     bus_state->DMA1INT.previously_enabled = false;
@@ -381,7 +380,7 @@ INLINE half* get_half_ioreg_ptr(word addr, bool write) {
         case IO_RCNT: return &bus->RCNT.raw;
         case IO_JOYCNT: return &bus->JOYCNT.raw;
         case IO_IME: return &bus->interrupt_master_enable.raw;
-        case IO_SOUNDBIAS: return &bus->SOUNDBIAS.raw;
+        case IO_SOUNDBIAS: return apu_ioreg_ptr(apu, regnum);
         case IO_TM0CNT_L: {
             if (write) {
                 return &bus->TMCNT_L[0].raw;
@@ -443,8 +442,7 @@ INLINE half* get_half_ioreg_ptr(word addr, bool write) {
         case WAVE_RAM2_H:
         case WAVE_RAM3_L:
         case WAVE_RAM3_H:
-            logwarn("Ignoring access to sound register: 0x%03X", regnum)
-            return NULL;
+            return apu_ioreg_ptr(apu, regnum);
 
         case IO_SIOCNT:
         case IO_SIOMULTI0:
@@ -532,6 +530,9 @@ INLINE void write_half_ioreg_masked(word addr, half value, half mask) {
             case IO_IME:
                 mask = 0b1;
                 break;
+            case IO_SOUNDCNT_X:
+                mask &= 0b10000000; // Channel on flags are read-only
+                break;
             case IO_IF: {
                 bus->IF.raw &= ~value;
                 return;
@@ -588,6 +589,21 @@ INLINE void write_half_ioreg_masked(word addr, half value, half mask) {
             case IO_WAITCNT:
                 on_waitcnt_updated();
                 break;
+            case IO_SOUND1CNT_L:
+            case IO_SOUND1CNT_H:
+            case IO_SOUND1CNT_X:
+            case IO_SOUND2CNT_L:
+            case IO_SOUND2CNT_H:
+            case IO_SOUND3CNT_L:
+            case IO_SOUND3CNT_H:
+            case IO_SOUND3CNT_X:
+            case IO_SOUND4CNT_L:
+            case IO_SOUND4CNT_H:
+            case IO_SOUNDCNT_L:
+            case IO_SOUNDCNT_H:
+            case IO_SOUNDCNT_X:
+                apu_ioreg_written(apu, addr & 0xFFF);
+                break;
         }
     } else {
         logwarn("Ignoring write to half ioreg 0x%08X", addr)
@@ -1072,6 +1088,7 @@ void gba_write_byte(word addr, byte value, access_type_t access_type) {
             word upper_index = lower_index + 1;
             ppu->pram[lower_index] = value;
             ppu->pram[upper_index] = value;
+            mark_pram_dirty(ppu);
             break;
         }
         case REGION_VRAM: {
@@ -1083,6 +1100,7 @@ void gba_write_byte(word addr, byte value, access_type_t access_type) {
                 word upper_index = lower_index + 1;
                 ppu->vram[lower_index] = value;
                 ppu->vram[upper_index] = value;
+                mark_vram_dirty(ppu, lower_index);
             }
             break;
         }
@@ -1109,7 +1127,7 @@ void gba_write_byte(word addr, byte value, access_type_t access_type) {
             switch (bus->backup_type) {
                 case SRAM:
                     mem->backup[addr & 0x7FFF] = value;
-                    mem->backup_dirty = true;
+                    mark_backup_dirty(mem, addr & 0x7FFF, sizeof(byte));
                     break;
                 case UNKNOWN:
                     logwarn("Tried to access backup when backup type unknown!")
@@ -1180,12 +1198,14 @@ void gba_write_half(word addr, half value, access_type_t access_type) {
         case REGION_PRAM: {
             word index = (addr - 0x5000000) % 0x400;
             half_to_byte_array(ppu->pram, index, value);
+            mark_pram_dirty(ppu);
             break;
         }
         case REGION_VRAM: {
             word index = addr - 0x06000000;
             index %= VRAM_SIZE;
             half_to_byte_array(ppu->vram, index, value);
+            mark_vram_dirty(ppu, index);
             break;
         }
         case REGION_OAM: {
@@ -1193,6 +1213,7 @@ void gba_write_half(word addr, half value, access_type_t access_type) {
             index %= OAM_SIZE;
             ppu->oam[index] = value;
             half_to_byte_array(ppu->oam, index, value);
+            mark_oam_dirty(ppu);
             break;
         }
         case REGION_GAMEPAK0_L:
@@ -1219,7 +1240,7 @@ void gba_write_half(word addr, half value, access_type_t access_type) {
             switch (bus->backup_type) {
                 case SRAM:
                     half_to_byte_array(mem->backup, addr & 0x7FFF, value);
-                    mem->backup_dirty = true;
+                    mark_backup_dirty(mem, addr & 0x7FFF, sizeof(half));
                     break;
                 case UNKNOWN:
                     logwarn("Tried to access backup when backup type unknown!")
@@ -1411,12 +1432,14 @@ void gba_write_word(word addr, word value, access_type_t access_type) {
         case REGION_PRAM: {
             word index = (addr - 0x5000000) % 0x400;
             word_to_byte_array(ppu->pram, index, value);
+            mark_pram_dirty(ppu);
             break;
         }
         case REGION_VRAM: {
             word index = addr - 0x06000000;
             index %= VRAM_SIZE;
             word_to_byte_array(ppu->vram, index, value);
+            mark_vram_dirty(ppu, index);
             break;
         }
         case REGION_OAM: {
@@ -1424,6 +1447,7 @@ void gba_write_word(word addr, word value, access_type_t access_type) {
             index %= OAM_SIZE;
             ppu->oam[index] = value;
             word_to_byte_array(ppu->oam, index, value);
+            mark_oam_dirty(ppu);
             break;
         }
         case REGION_GAMEPAK0_L:
@@ -1457,7 +1481,7 @@ void gba_write_word(word addr, word value, access_type_t access_type) {
             switch (bus->backup_type) {
                 case SRAM:
                     word_to_byte_array(mem->backup, addr & 0x7FFF, value);
-                    mem->backup_dirty = true;
+                    mark_backup_dirty(mem, addr & 0x7FFF, sizeof(word));
                     break;
                 case UNKNOWN:
                     logwarn("Tried to access backup when backup type unknown!")
@@ -1475,3 +1499,91 @@ void gba_write_word(word addr, word value, access_type_t access_type) {
             return;
     }
 }
+
+INLINE byte* direct_ptr(word address, word length, bool write) {
+    half region = address >> 24;
+    if ((address & 0xFFFFFF) + length > 0x1000000) {
+        return NULL;
+    }
+    switch (region) {
+        case REGION_EWRAM: {
+            word index = (address - 0x02000000) % 0x40000;
+            return index + length <= 0x40000 ? &mem->ewram[index] : NULL;
+        }
+        case REGION_IWRAM: {
+            word index = (address - 0x03000000) % 0x8000;
+            return index + length <= 0x8000 ? &mem->iwram[index] : NULL;
+        }
+        case REGION_PRAM: {
+            word index = (address - 0x5000000) % PRAM_SIZE;
+            return index + length <= PRAM_SIZE ? &ppu->pram[index] : NULL;
+        }
+        case REGION_VRAM: {
+            word index = (address - 0x06000000) % VRAM_SIZE;
+            return index + length <= VRAM_SIZE ? &ppu->vram[index] : NULL;
+        }
+        case REGION_OAM: {
+            word index = (address - 0x07000000) % OAM_SIZE;
+            return index + length <= OAM_SIZE ? &ppu->oam[index] : NULL;
+        }
+        case REGION_GAMEPAK0_L:
+            if (bus->allow_gpio_read && address < 0x080000CA && address + length > 0x080000C4) {
+                return NULL;
+            }
+        case REGION_GAMEPAK0_H:
+        case REGION_GAMEPAK1_L:
+        case REGION_GAMEPAK1_H:
+        case REGION_GAMEPAK2_L: {
+            word index = address & 0x1FFFFFF;
+            return !write && index + length <= mem->rom_size ? &mem->rom[index] : NULL;
+        }
+        default:
+            return NULL;
+    }
+}
+
+const byte* gba_direct_read_ptr(word address, word length) {
+    return direct_ptr(address, length, false);
+}
+
+byte* gba_direct_write_ptr(word address, word length) {
+    return direct_ptr(address, length, true);
+}
+
+void gba_direct_written(word address, word length) {
+    switch (address >> 24) {
+        case REGION_PRAM:
+            mark_pram_dirty(ppu);
+            break;
+        case REGION_VRAM: {
+            word index = (address - 0x06000000) % VRAM_SIZE;
+            for (word tile = index & ~(VRAM_TILE_SIZE - 1); tile < index + length; tile += VRAM_TILE_SIZE) {
+                mark_vram_dirty(ppu, tile);
+            }
+            break;
+        }
+        case REGION_OAM:
+            mark_oam_dirty(ppu);
+            break;
+        default:
+            break;
+    }
+}
+
+bool gba_is_eeprom(word address, word length) {
+    word last = address + length - 1;
+    return bus->backup_type == EEPROM && (address >> 24) == REGION_GAMEPAK2_H && (last >> 24) == REGION_GAMEPAK2_H
+           && (mem->rom_size <= 0x1000000 || address >= 0xDFFFF00);
+}
+
+void gba_tick_burst(word address, size_t access_size, word count) {
+    if (count > 0) {
+        half region = address >> 24;
+        tick_memory_waitstate(ACCESS_NONSEQUENTIAL, access_size, region);
+        if (access_size == sizeof(word)) {
+            cpu->this_step_ticks += (count - 1) * sequential_word_cycles[region];
+        } else {
+            cpu->this_step_ticks += (count - 1) * sequential_byte_half_cycles[region];
+        }
+    }
+}
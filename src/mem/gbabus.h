@@ -143,11 +143,6 @@ typedef union KEYCNT {
     half raw;
 } KEYCNT_t;
 
-// MOVE THIS TO AN APPROPRIATE PLACE
-typedef union SOUNDBIAS {
-    half raw;
-} SOUNDBIAS_t;
-
 typedef union TMCNT_L {
     half raw;
     half timer_reload;
@@ -306,8 +301,6 @@ typedef struct gbabus {
     JOYCNT_t JOYCNT;
     KEYCNT_t KEYCNT;
 
-    SOUNDBIAS_t SOUNDBIAS;
-
     bool TMSTART[4];
     byte TMACTIVE[4];
     byte num_active_timers;
@@ -337,6 +330,16 @@ void gba_write_byte(word addr, byte value, access_type_t access_type);
 void gba_write_half(word address, half value, access_type_t access_type);
 word gba_read_word(word address, access_type_t access_type);
 void gba_write_word(word address, word value, access_type_t access_type);
+// For DMA fast paths that move memory around without going through the accessors above. Both return where the given
+// range lives, if it's entirely within one region of plain memory, or NULL. Reads can also come from the ROM.
+const byte* gba_direct_read_ptr(word address, word length);
+byte* gba_direct_write_ptr(word address, word length);
+// Lets the PPU know about a write that went through gba_direct_write_ptr
+void gba_direct_written(word address, word length);
+// Whether the whole range is the EEPROM's, rather than ROM
+bool gba_is_eeprom(word address, word length);
+// Charges the waitstates for count accesses in a row that didn't go through the accessors. The first is nonsequential.
+void gba_tick_burst(word address, size_t access_size, word count);
 int gba_dma();
 
 void request_interrupt(gba_interrupt_t interrupt);
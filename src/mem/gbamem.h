@@ -14,6 +14,13 @@
 // Backup (on cartridge)
 #define SRAM_SIZE 0x8000
 
+// Changes to the backup are tracked per block, so only those parts of the save file get rewritten. Flash is erased a
+// 4K sector at a time, and EEPROMs (the only backups 8K or smaller) are written 8 bytes at a time.
+#define BACKUP_SECTOR_SIZE 0x1000
+#define EEPROM_BLOCK_SIZE 8
+#define EEPROM_MAX_SIZE 0x2000
+#define BACKUP_MAX_BLOCKS 1024
+
 typedef enum flash_state {
     FLASH_READY,
     FLASH_CMD_1,
@@ -44,7 +51,8 @@ typedef struct gbamem {
     byte iwram[IWRAM_SIZE];
     size_t backup_size;
     byte* backup;
-    bool backup_dirty;
+    bool backup_dirty; // Since the last frame, for debouncing
+    uint64_t backup_dirty_blocks[BACKUP_MAX_BLOCKS / 64]; // Since the last flush
     const char* backup_path;
     const char** savestate_path;
 
@@ -65,4 +73,16 @@ typedef struct gbamem {
 
 gbamem_t* init_mem();
 
+INLINE word backup_block_size(gbamem_t* mem) {
+    return mem->backup_size <= EEPROM_MAX_SIZE ? EEPROM_BLOCK_SIZE : BACKUP_SECTOR_SIZE;
+}
+
+INLINE void mark_backup_dirty(gbamem_t* mem, word index, word length) {
+    word block_size = backup_block_size(mem);
+    for (word block = index / block_size; block <= (index + length - 1) / block_size && block < BACKUP_MAX_BLOCKS; block++) {
+        mem->backup_dirty_blocks[block / 64] |= 1ull << (block % 64);
+    }
+    mem->backup_dirty = true;
+}
+
 #endif
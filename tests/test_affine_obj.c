@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include "test_common.h"
+#include "../src/graphics/ppu.h"
+
+// Checks the span based affine OBJ path against the old per-pixel math. Each texel of the sprite holds its own x (or y)
+// plus one, and OBJ palette entry i is color i, so every pixel drawn says exactly which texel it came from.
+
+#define TRIALS 20000
+
+// Affine object modes, as in attr0
+#define AFFINE 0b01
+#define HIDE   0b10
+#define DOUBLE 0b11
+
+typedef struct obj_affine {
+    int16_t pa;
+    int16_t pb;
+    int16_t pc;
+    int16_t pd;
+} obj_affine_t;
+
+
+static int16_t random_affine_param() {
+    switch (rand() % 4) {
+        case 0: return (int16_t)(rand() & 0xFFFF);
+        case 1: return (int16_t)((rand() % 0x401) - 0x200);
+        case 2: return (int16_t)((rand() % 0x41) - 0x20);
+        default: return (int16_t)((rand() % 0x201) - 0x100);
+    }
+}
+
+static void fill_texels(gba_ppu_t* ppu, int width, int height, bool y_coords) {
+    int tiles_wide = width / 8;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            word address = 0x10000 + ((y / 8) * tiles_wide + x / 8) * 64 + (y % 8) * 8 + x % 8;
+            ppu->vram[address] = (y_coords ? y : x) + 1;
+        }
+    }
+    ppu_invalidate_caches(ppu);
+}
+
+// The texel coordinate the old renderer drew at screen_x, or -1 if it left the pixel alone
+static int reference_texel(int screen_x, int adjusted_x, int sprite_y, int width, int height, bool is_double_affine,
+                           obj_affine_t affine, bool y_coords) {
+    int hwidth = width / 2;
+    int hheight = height / 2;
+    int sprite_x = screen_x - adjusted_x;
+    int sprite_x_start = is_double_affine ? -hwidth : 0;
+    int sprite_x_end = is_double_affine ? width + hwidth : width;
+    if (sprite_x < sprite_x_start || sprite_x >= sprite_x_end) {
+        return -1;
+    }
+
+    int texel_x = ((affine.pa * (sprite_x - hwidth) + affine.pb * (sprite_y - hheight)) >> 8) + hwidth;
+    if (texel_x >= width || texel_x < 0) {
+        return -1;
+    }
+    int texel_y = ((affine.pc * (sprite_x - hwidth) + affine.pd * (sprite_y - hheight)) >> 8) + hheight;
+    if (texel_y >= height || texel_y < 0) {
+        return -1;
+    }
+    return y_coords ? texel_y : texel_x;
+}
+
+int main(int argc, char** argv) {
+    log_set_verbosity(4);
+    srand(0x0B1EC7);
+
+    gba_ppu_t* ppu = init_ppu(false);
+    ppu->DISPCNT.screen_display_obj = true;
+    ppu->DISPCNT.obj_character_vram_mapping = 1;
+    byte screen_line[GBA_SCREEN_X * 4];
+    for (int i = 0; i < 256; i++) {
+        ppu->pram[0x200 + i * 2] = i;
+    }
+    mark_pram_dirty(ppu);
+
+    int drawn = 0;
+    for (int trial = 0; trial < TRIALS; trial++) {
+        bool y_coords = trial % 2;
+        obj_attr0_t attr0 = {.raw = 0};
+        obj_attr1_t attr1 = {.raw = 0};
+        obj_attr2_t attr2 = {.raw = 0};
+        bool is_double_affine = rand() % 2;
+        attr0.affine_object_mode = is_double_affine ? DOUBLE : AFFINE;
+        attr0.is_256color = true;
+        attr0.shape = rand() % 3;
+        attr0.y = rand() % 256;
+        attr1.size = rand() % 4;
+        attr1.x = rand() % 512;
+        attr1.affine_index = rand() % 32;
+
+        obj_affine_t affine;
+        affine.pa = random_affine_param();
+        affine.pb = random_affine_param();
+        affine.pc = random_affine_param();
+        affine.pd = random_affine_param();
+
+        memset(ppu->oam, 0, OAM_SIZE);
+        obj_attr0_t hidden = {.raw = 0};
+        hidden.affine_object_mode = HIDE;
+        for (int sprite = 1; sprite < 128; sprite++) {
+            ppu->oam[sprite * 8 + 0] = hidden.raw & 0xFF;
+            ppu->oam[sprite * 8 + 1] = hidden.raw >> 8;
+        }
+        ppu->oam[0] = attr0.raw & 0xFF;
+        ppu->oam[1] = attr0.raw >> 8;
+        ppu->oam[2] = attr1.raw & 0xFF;
+        ppu->oam[3] = attr1.raw >> 8;
+        ppu->oam[4] = attr2.raw & 0xFF;
+        ppu->oam[5] = attr2.raw >> 8;
+        word params = attr1.affine_index * 32;
+        ppu->oam[params + 6] = affine.pa & 0xFF;
+        ppu->oam[params + 7] = (affine.pa >> 8) & 0xFF;
+        ppu->oam[params + 14] = affine.pb & 0xFF;
+        ppu->oam[params + 15] = (affine.pb >> 8) & 0xFF;
+        ppu->oam[params + 22] = affine.pc & 0xFF;
+        ppu->oam[params + 23] = (affine.pc >> 8) & 0xFF;
+        ppu->oam[params + 30] = affine.pd & 0xFF;
+        ppu->oam[params + 31] = (affine.pd >> 8) & 0xFF;
+        mark_oam_dirty(ppu);
+
+        int width = sprite_widths[attr0.shape][attr1.size];
+        int height = sprite_heights[attr0.shape][attr1.size];
+        fill_texels(ppu, width, height, y_coords);
+
+        int adjusted_x = attr1.x + (is_double_affine ? width / 2 : 0);
+        int adjusted_y = attr0.y + (is_double_affine ? height / 2 : 0);
+        if (adjusted_x >= 240) {
+            adjusted_x -= 512;
+        }
+        if (adjusted_y >= 160) {
+            adjusted_y -= 256;
+        }
+        int screen_min_y = adjusted_y - (is_double_affine ? height / 2 : 0);
+        int screen_max_y = adjusted_y + height + (is_double_affine ? height / 2 : 0);
+
+        // Pick a line the sprite is on most of the time, but not always
+        int line = rand() % GBA_SCREEN_Y;
+        if (rand() % 8 && screen_min_y < GBA_SCREEN_Y && screen_max_y > 0) {
+            int first = screen_min_y < 0 ? 0 : screen_min_y;
+            int last = screen_max_y > GBA_SCREEN_Y ? GBA_SCREEN_Y : screen_max_y;
+            line = first + rand() % (last - first);
+        }
+        ppu->y = line;
+        render_line(ppu, screen_line);
+
+        bool visible = line >= screen_min_y && line < screen_max_y;
+        for (int x = 0; x < GBA_SCREEN_X; x++) {
+            int expected = visible ? reference_texel(x, adjusted_x, line - adjusted_y, width, height, is_double_affine, affine, y_coords) : -1;
+            bool expected_drawn = expected >= 0;
+            bool actual_drawn = line_mask_get(ppu->obj_drawn, x);
+            if (expected_drawn != actual_drawn) {
+                logfatal("Trial %d: pixel %d on line %d should%s have been drawn (attr0 0x%04X attr1 0x%04X pa %d pb %d pc %d pd %d)",
+                         trial, x, line, expected_drawn ? "" : " not", attr0.raw, attr1.raw, affine.pa, affine.pb, affine.pc, affine.pd)
+            }
+            if (expected_drawn) {
+                if (ppu->objbuf[x].color.raw != expected + 1) {
+                    logfatal("Trial %d: pixel %d on line %d should be texel %d, not %d", trial, x, line, expected, ppu->objbuf[x].color.raw - 1)
+                }
+                drawn++;
+            }
+        }
+    }
+
+    // Make sure the sweep actually drew something
+    if (drawn < TRIALS) {
+        logfatal("Only %d pixels drawn over %d trials", drawn, TRIALS)
+    }
+    loginfo("Affine OBJ output matches over %d trials (%d pixels drawn)", TRIALS, drawn)
+    return 0;
+}
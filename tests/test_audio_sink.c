@@ -0,0 +1,96 @@
+#include <math.h>
+#include "test_common.h"
+#include "../src/audio/audio.h"
+
+// Runs the CPU with the memory sink and pops what the APU pushes at the end of each audio frame: silence at first,
+// then a square wave on PSG channel 2, which has to come out at the right pitch on both sides with nothing dropped.
+
+// A quarter of a second at a time
+#define SAMPLES_PER_CHECK (AUDIO_SAMPLE_RATE / 4 * AUDIO_CHANNELS)
+
+// 131072 / (2048 - 1750) Hz, about 440
+#define SQUARE_RATE 1750
+#define SQUARE_FREQUENCY (131072.0 / (2048 - SQUARE_RATE))
+
+static float samples[SAMPLES_PER_CHECK];
+
+static void collect_samples() {
+    audio_ring_t* ring = apu->sink->ring;
+    int collected = 0;
+    while (collected < SAMPLES_PER_CHECK) {
+        gba_system_step();
+        int available = (int)audio_ring_available(ring);
+        if (available > SAMPLES_PER_CHECK - collected) {
+            available = SAMPLES_PER_CHECK - collected;
+        }
+        collected += audio_ring_pop(ring, &samples[collected], available);
+    }
+    if (ring->overruns != 0 || ring->underruns != 0) {
+        logfatal("Memory sink had %lu overruns and %lu underruns", (unsigned long)ring->overruns, (unsigned long)ring->underruns)
+    }
+}
+
+// How many times one side crosses its own average level
+static int count_crossings(int side, float* range) {
+    float sum = 0;
+    float min = samples[side];
+    float max = samples[side];
+    for (int i = side; i < SAMPLES_PER_CHECK; i += AUDIO_CHANNELS) {
+        sum += samples[i];
+        min = fminf(min, samples[i]);
+        max = fmaxf(max, samples[i]);
+    }
+    float average = sum / (SAMPLES_PER_CHECK / AUDIO_CHANNELS);
+    *range = max - min;
+
+    int crossings = 0;
+    bool above = samples[side] > average;
+    for (int i = side; i < SAMPLES_PER_CHECK; i += AUDIO_CHANNELS) {
+        if ((samples[i] > average) != above) {
+            above = !above;
+            crossings++;
+        }
+    }
+    return crossings;
+}
+
+int main(int argc, char** argv) {
+    log_set_verbosity(0);
+    set_audio_sink(AUDIO_SINK_MEMORY, NULL);
+    init_gbasystem("arm.gba", NULL, false);
+    set_render_policy(RENDER_NEVER, 0);
+    skip_bios(cpu);
+
+    if (apu->sink->type != AUDIO_SINK_MEMORY || !apu->generate_samples) {
+        logfatal("Memory sink wasn't picked up")
+    }
+
+    collect_samples();
+    for (int side = 0; side < AUDIO_CHANNELS; side++) {
+        float range;
+        count_crossings(side, &range);
+        if (range > 0.001f) {
+            logfatal("Expected silence on side %d with sound off, samples vary by %f", side, range)
+        }
+    }
+
+    gba_write_half(0x04000084, 0x0080, ACCESS_NONSEQUENTIAL); // Master enable
+    gba_write_half(0x04000080, 0x2277, ACCESS_NONSEQUENTIAL); // Full PSG volume, channel 2 on both sides
+    gba_write_half(0x04000082, 0x0002, ACCESS_NONSEQUENTIAL); // PSG at 100%
+    gba_write_half(0x04000068, 0xF080, ACCESS_NONSEQUENTIAL); // 50% duty, constant volume 15
+    gba_write_half(0x0400006C, 0x8000 | SQUARE_RATE, ACCESS_NONSEQUENTIAL); // Start
+
+    collect_samples();
+    int expected = (int)(2 * SQUARE_FREQUENCY / 4);
+    for (int side = 0; side < AUDIO_CHANNELS; side++) {
+        float range;
+        int crossings = count_crossings(side, &range);
+        if (range < 0.05f) {
+            logfatal("Expected a square wave on side %d, samples only vary by %f", side, range)
+        }
+        if (abs(crossings - expected) > expected / 20) {
+            logfatal("Square wave on side %d crossed its average %d times, expected about %d", side, crossings, expected)
+        }
+    }
+    return 0;
+}
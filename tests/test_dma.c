@@ -0,0 +1,198 @@
+#include <string.h>
+#include "test_common.h"
+#include "../src/mem/dma.h"
+#include "../src/graphics/ppu.h"
+
+// Runs DMAs that the bulk path can take (and some it has to turn down) through gba_dma() and compares memory, timing
+// and the final addresses with the same transfer done one element at a time through the bus, the way the element
+// loop in dma.c does it.
+
+#define SOURCE_INCREMENT 0
+#define SOURCE_DECREMENT 1
+#define SOURCE_FIXED     2
+
+#define DEST_INCREMENT 0
+#define DEST_DECREMENT 1
+#define DEST_FIXED     2
+#define DEST_RELOAD    3
+
+typedef struct memory_snapshot {
+    byte ewram[EWRAM_SIZE];
+    byte iwram[IWRAM_SIZE];
+    byte pram[PRAM_SIZE];
+    byte vram[VRAM_SIZE];
+    byte oam[OAM_SIZE];
+} memory_snapshot_t;
+
+typedef struct dma_result {
+    int ticks;
+    word source;
+    word dest;
+} dma_result_t;
+
+static memory_snapshot_t initial;
+static memory_snapshot_t expected;
+static memory_snapshot_t actual;
+
+static void save_memory(memory_snapshot_t* snapshot) {
+    memcpy(snapshot->ewram, mem->ewram, EWRAM_SIZE);
+    memcpy(snapshot->iwram, mem->iwram, IWRAM_SIZE);
+    memcpy(snapshot->pram, ppu->pram, PRAM_SIZE);
+    memcpy(snapshot->vram, ppu->vram, VRAM_SIZE);
+    memcpy(snapshot->oam, ppu->oam, OAM_SIZE);
+}
+
+static void restore_memory(const memory_snapshot_t* snapshot) {
+    memcpy(mem->ewram, snapshot->ewram, EWRAM_SIZE);
+    memcpy(mem->iwram, snapshot->iwram, IWRAM_SIZE);
+    memcpy(ppu->pram, snapshot->pram, PRAM_SIZE);
+    memcpy(ppu->vram, snapshot->vram, VRAM_SIZE);
+    memcpy(ppu->oam, snapshot->oam, OAM_SIZE);
+    ppu_invalidate_caches(ppu);
+}
+
+static void randomize_memory(memory_snapshot_t* snapshot, word seed) {
+    byte* bytes = (byte*)snapshot;
+    for (size_t i = 0; i < sizeof(memory_snapshot_t); i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        bytes[i] = seed;
+    }
+}
+
+static word step_address(word address, int control, word size) {
+    switch (control) {
+        case 0:
+        case 3: return address + size;
+        case 1: return address - size;
+        default: return address;
+    }
+}
+
+// What the element loop does with the same registers
+static dma_result_t element_dma(word sad, word dad, word count, int source_control, int dest_control, bool is_word) {
+    word size = is_word ? sizeof(word) : sizeof(half);
+    access_type_t access = ACCESS_NONSEQUENTIAL;
+    cpu->this_step_ticks = 0;
+    for (word i = 0; i < count; i++) {
+        if (is_word) {
+            gba_write_word(dad, gba_read_word(sad, access), access);
+        } else {
+            gba_write_half(dad, gba_read_half(sad, access), access);
+        }
+        access = ACCESS_SEQUENTIAL;
+        sad = step_address(sad, source_control, size);
+        dad = step_address(dad, dest_control, size);
+    }
+    dma_result_t result = {cpu->this_step_ticks, sad, dad};
+    return result;
+}
+
+static dma_result_t start_dma(int n, word sad, word dad, word wc, int source_control, int dest_control, bool is_word) {
+    DMACNTH_t cnth = {.raw = 0};
+    cnth.source_addr_control = source_control;
+    cnth.dest_addr_control = dest_control;
+    cnth.dma_transfer_type = is_word;
+    cnth.dma_start_time = Immediately;
+    cnth.dma_enable = true;
+
+    DMAINT_t* dmaint;
+    switch (n) {
+        case 0:
+            bus->DMA0SAD.addr = sad;
+            bus->DMA0DAD.addr = dad;
+            bus->DMA0CNT_L.wc = wc;
+            bus->DMA0CNT_H = cnth;
+            dmaint = &bus->DMA0INT;
+            break;
+        case 3:
+            bus->DMA3SAD.addr = sad;
+            bus->DMA3DAD.addr = dad;
+            bus->DMA3CNT_L.wc = wc;
+            bus->DMA3CNT_H = cnth;
+            dmaint = &bus->DMA3INT;
+            break;
+        default:
+            logfatal("Unexpected DMA channel %d", n)
+    }
+    dmaint->previously_enabled = false;
+
+    cpu->this_step_ticks = 0;
+    gba_dma();
+    dma_result_t result = {cpu->this_step_ticks, dmaint->current_source_address, dmaint->current_dest_address};
+    return result;
+}
+
+static void compare_memory(const char* name, const char* region, const byte* expected_bytes, const byte* actual_bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (expected_bytes[i] != actual_bytes[i]) {
+            logfatal("%s: %s differs at offset 0x%05zX, expected 0x%02X, got 0x%02X", name, region, i, expected_bytes[i], actual_bytes[i])
+        }
+    }
+}
+
+static void check_dma(const char* name, int n, word sad, word dad, word wc, int source_control, int dest_control, bool is_word) {
+    static word seed = 0x0D3A0001;
+    randomize_memory(&initial, seed++);
+
+    word count = wc != 0 ? wc : (n == 3 ? 0x10000 : 0x4000);
+    restore_memory(&initial);
+    dma_result_t reference = element_dma(sad, dad, count, source_control, dest_control, is_word);
+    save_memory(&expected);
+
+    restore_memory(&initial);
+    dma_result_t result = start_dma(n, sad, dad, wc, source_control, dest_control, is_word);
+    save_memory(&actual);
+
+    compare_memory(name, "EWRAM", expected.ewram, actual.ewram, EWRAM_SIZE);
+    compare_memory(name, "IWRAM", expected.iwram, actual.iwram, IWRAM_SIZE);
+    compare_memory(name, "PRAM", expected.pram, actual.pram, PRAM_SIZE);
+    compare_memory(name, "VRAM", expected.vram, actual.vram, VRAM_SIZE);
+    compare_memory(name, "OAM", expected.oam, actual.oam, OAM_SIZE);
+    if (reference.ticks != result.ticks) {
+        logfatal("%s: took %d ticks, expected %d", name, result.ticks, reference.ticks)
+    }
+    if (reference.source != result.source || reference.dest != result.dest) {
+        logfatal("%s: ended at 0x%08X => 0x%08X, expected 0x%08X => 0x%08X", name, result.source, result.dest, reference.source, reference.dest)
+    }
+}
+
+int main(int argc, char** argv) {
+    init_gbasystem("arm.gba", NULL, false);
+    set_render_policy(RENDER_NEVER, 0);
+    // Every element of the loop is logged
+    log_set_verbosity(0);
+
+    for (int is_word = 0; is_word < 2; is_word++) {
+        check_dma("EWRAM to IWRAM", 3, 0x02000100, 0x03000200, 0x180, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("ROM to EWRAM", 3, 0x08000200, 0x02001000, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("EWRAM to VRAM", 3, 0x02003000, 0x06010000, 0x400, SOURCE_INCREMENT, DEST_RELOAD, is_word);
+        check_dma("EWRAM to OAM", 3, 0x02003000, 0x07000000, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("Unaligned addresses", 3, 0x02000103, 0x03000201, 0x40, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("Decrementing source", 3, 0x02000800, 0x03000200, 0x100, SOURCE_DECREMENT, DEST_INCREMENT, is_word);
+        check_dma("Decrementing dest", 3, 0x02000100, 0x03000800, 0x100, SOURCE_INCREMENT, DEST_DECREMENT, is_word);
+        check_dma("Fixed source", 3, 0x03000010, 0x02004000, 0x200, SOURCE_FIXED, DEST_INCREMENT, is_word);
+        check_dma("Fixed dest", 3, 0x02004000, 0x03000010, 0x200, SOURCE_INCREMENT, DEST_FIXED, is_word);
+        check_dma("Fixed source and dest", 3, 0x02004000, 0x03000010, 0x20, SOURCE_FIXED, DEST_FIXED, is_word);
+
+        // Copying down over the source is safe on host pointers, copying up has to smear like the element loop does
+        check_dma("Overlapping, dest below source", 3, 0x02000100, 0x02000080, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("Overlapping, dest above source", 3, 0x02000100, 0x02000180, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("Overlapping, same address", 3, 0x03000400, 0x03000400, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("Overlapping, fixed source inside dest", 3, 0x02000140, 0x02000100, 0x100, SOURCE_FIXED, DEST_INCREMENT, is_word);
+        check_dma("Overlapping through a mirror", 3, 0x03008100, 0x03000080, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+
+        // Off the end of a region, into its mirror or the next region over
+        check_dma("Source off the end of IWRAM", 3, 0x03007F00, 0x02000000, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("Dest off the end of EWRAM", 3, 0x03000000, 0x0203FF80, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("Dest off the end of the EWRAM area", 3, 0x03000000, 0x02FFFF80, 0x100, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+        check_dma("Dest off the end of PRAM", 3, 0x02000000, 0x050003C0, 0x40, SOURCE_INCREMENT, DEST_INCREMENT, is_word);
+    }
+
+    // A count of 0 is the largest count the channel can do
+    check_dma("DMA0 words, count 0", 0, 0x02000000, 0x02010000, 0, SOURCE_INCREMENT, DEST_INCREMENT, true);
+    check_dma("DMA3 halves, count 0", 3, 0x02000000, 0x02020000, 0, SOURCE_INCREMENT, DEST_INCREMENT, false);
+    check_dma("DMA3 words, count 0", 3, 0x02000000, 0x03000000, 0, SOURCE_INCREMENT, DEST_INCREMENT, true);
+    return 0;
+}
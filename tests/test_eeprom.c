@@ -0,0 +1,143 @@
+#include <string.h>
+#include "test_common.h"
+#include "../src/mem/backup/eeprom.h"
+
+// Runs the same stream of EEPROM frames bit by bit through write_half_eeprom/read_half_eeprom and whole through
+// write_eeprom_frame/read_eeprom_frame, for both sizes. The backup, everything read back and the number of polls each
+// write needs before the EEPROM is ready again all have to come out the same.
+
+#define EEPROM_ADDRESS 0x0D000000
+#define OPERATIONS 2000
+#define READ_LENGTH (64 + 4)
+
+typedef struct eeprom_run {
+    byte backup[0x2000];
+    size_t backup_size;
+    byte reads[OPERATIONS][READ_LENGTH * sizeof(half)];
+    int polls[OPERATIONS];
+    eeprom_state_t state;
+} eeprom_run_t;
+
+static eeprom_run_t bitwise;
+static eeprom_run_t framed;
+
+static uint32_t rng;
+
+static uint32_t next_random() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Only the low bit of each half means anything to the EEPROM, the rest is filled with junk
+static void put_bits(byte* frame, int* length, word value, int bits) {
+    for (int bit = bits - 1; bit >= 0; bit--) {
+        half_to_byte_array(frame, (*length)++ * sizeof(half), ((value >> bit) & 1) | (next_random() & 0xFFFE));
+    }
+}
+
+static void reset_eeprom() {
+    free(mem->backup);
+    mem->backup = NULL;
+    mem->backup_size = 0;
+    mem->eeprom_initialized = false;
+    mem->eeprom_state = EEPROM_READY;
+    mem->eeprom_bits_remaining = 0;
+    mem->eeprom_address = 0;
+    memset(mem->backup_dirty_blocks, 0, sizeof(mem->backup_dirty_blocks));
+}
+
+static void send_frame(bool use_frames, const byte* frame, int length) {
+    // The EEPROM's size is taken from the length of the first transfer
+    bus->DMA3CNT_L.wc = length;
+    if (use_frames) {
+        write_eeprom_frame(3, bus, mem, EEPROM_ADDRESS, frame, length);
+    } else {
+        for (int i = 0; i < length; i++) {
+            write_half_eeprom(3, bus, mem, EEPROM_ADDRESS, half_from_byte_array((byte*)frame, i * sizeof(half)));
+        }
+    }
+}
+
+static void run(eeprom_run_t* result, bool use_frames, int address_bits, size_t size, uint32_t seed) {
+    reset_eeprom();
+    rng = seed;
+    byte frame[(2 + 14 + 64 + 1) * sizeof(half)];
+
+    for (int op = 0; op < OPERATIONS; op++) {
+        int length = 0;
+        // 8K EEPROMs take 14 address bits, but only the low 10 are used
+        word block = next_random() % (size / 8);
+        // The first transfer has to be a read for the size to be detected
+        bool write = op > 0 && next_random() % 2;
+        if (write) {
+            put_bits(frame, &length, 0b10, 2);
+            put_bits(frame, &length, block, address_bits);
+            put_bits(frame, &length, next_random(), 32);
+            put_bits(frame, &length, next_random(), 32);
+            put_bits(frame, &length, 0, 1);
+            send_frame(use_frames, frame, length);
+
+            int polls = 0;
+            while ((read_half_eeprom(bus, mem, EEPROM_ADDRESS) & 1) == 0) {
+                polls++;
+            }
+            result->polls[op] = polls;
+        } else {
+            put_bits(frame, &length, 0b11, 2);
+            put_bits(frame, &length, block, address_bits);
+            put_bits(frame, &length, 0, 1);
+            send_frame(use_frames, frame, length);
+
+            byte* dest = result->reads[op];
+            if (use_frames) {
+                read_eeprom_frame(bus, mem, EEPROM_ADDRESS, dest, READ_LENGTH);
+            } else {
+                for (int i = 0; i < READ_LENGTH; i++) {
+                    half_to_byte_array(dest, i * sizeof(half), read_half_eeprom(bus, mem, EEPROM_ADDRESS));
+                }
+            }
+        }
+    }
+
+    result->backup_size = mem->backup_size;
+    memcpy(result->backup, mem->backup, mem->backup_size);
+    result->state = mem->eeprom_state;
+}
+
+static void compare(const char* name, int address_bits, size_t expected_size) {
+    memset(&bitwise, 0, sizeof(eeprom_run_t));
+    memset(&framed, 0, sizeof(eeprom_run_t));
+    run(&bitwise, false, address_bits, expected_size, 0x5EED0000 | address_bits);
+    run(&framed, true, address_bits, expected_size, 0x5EED0000 | address_bits);
+
+    if (bitwise.backup_size != expected_size || framed.backup_size != expected_size) {
+        logfatal("%s: expected a backup of 0x%zX bytes, got 0x%zX bit by bit and 0x%zX by frame",
+                 name, expected_size, bitwise.backup_size, framed.backup_size)
+    }
+    for (int op = 0; op < OPERATIONS; op++) {
+        if (bitwise.polls[op] != framed.polls[op]) {
+            logfatal("%s: operation %d took %d polls bit by bit, %d by frame", name, op, bitwise.polls[op], framed.polls[op])
+        }
+        if (memcmp(bitwise.reads[op], framed.reads[op], sizeof(bitwise.reads[op])) != 0) {
+            logfatal("%s: operation %d read different data bit by bit and by frame", name, op)
+        }
+    }
+    if (memcmp(bitwise.backup, framed.backup, expected_size) != 0) {
+        logfatal("%s: the backup differs between bit by bit and frame transfers", name)
+    }
+    ASSERT_EQUAL(0, "state", bitwise.state, framed.state)
+    loginfo("%s: %d operations match", name, OPERATIONS)
+}
+
+int main(int argc, char** argv) {
+    init_gbasystem("arm.gba", NULL, false);
+    set_render_policy(RENDER_NEVER, 0);
+    // The bit by bit path warns about every bit
+    log_set_verbosity(0);
+
+    compare("512B EEPROM", 6, 0x200);
+    compare("8K EEPROM", 14, 0x2000);
+    return 0;
+}
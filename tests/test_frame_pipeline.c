@@ -0,0 +1,73 @@
+#include <string.h>
+#include "test_common.h"
+#include "../src/graphics/frame_pipeline.h"
+
+// Headless with the frame pipeline (-E -P): at each VBlank, only the rows that changed in the finished frame may be
+// copied into the buffer the next frame is drawn to. The other buffer is filled with a marker before each VBlank, so
+// any row that isn't supposed to be copied has to still hold it afterwards.
+
+#define MARKER 0xA5
+
+static void check_rows_clear(const char* name) {
+    for (int i = 0; i < SCREEN_ROW_MASK_WORDS; i++) {
+        if (ppu->dirty_rows[i] != 0) {
+            logfatal("%s: rows still marked dirty after VBlank: 0x%016llX", name, (unsigned long long)ppu->dirty_rows[i])
+        }
+    }
+}
+
+static void check_copied_rows(const char* name, int changed_row) {
+    byte* finished = ppu->screen;
+    byte* next = finished == ppu->screen_buffers[0] ? ppu->screen_buffers[1] : ppu->screen_buffers[0];
+    memset(next, MARKER, GBA_SCREEN_Y * ppu->screen_pitch);
+
+    memset(ppu->dirty_rows, 0, sizeof(ppu->dirty_rows));
+    if (changed_row >= 0) {
+        memset(&finished[changed_row * ppu->screen_pitch], 0x3C, ppu->screen_pitch);
+        ppu->dirty_rows[changed_row / 64] |= 1ull << (changed_row % 64);
+    }
+    ppu_vblank(ppu);
+    frame_pipeline_sync();
+
+    if (ppu->screen != next) {
+        logfatal("%s: the next frame isn't being drawn to the other buffer", name)
+    }
+    for (int y = 0; y < GBA_SCREEN_Y; y++) {
+        bool copied = memcmp(&next[y * ppu->screen_pitch], &finished[y * ppu->screen_pitch], ppu->screen_pitch) == 0;
+        bool untouched = true;
+        for (int x = 0; x < ppu->screen_pitch; x++) {
+            untouched &= next[y * ppu->screen_pitch + x] == MARKER;
+        }
+        if (y == changed_row && !copied) {
+            logfatal("%s: row %d changed, but wasn't copied", name, y)
+        } else if (y != changed_row && !untouched) {
+            logfatal("%s: row %d didn't change, but was copied", name, y)
+        }
+    }
+    check_rows_clear(name);
+}
+
+int main(int argc, char** argv) {
+    log_set_verbosity(0);
+    init_gbasystem("arm.gba", NULL, false);
+    set_render_policy(RENDER_ALWAYS, 0);
+    frame_pipeline_start(ppu);
+
+    // Every row starts out dirty. The first VBlank copies them all, after that they have to be clear.
+    ppu_vblank(ppu);
+    frame_pipeline_sync();
+    check_rows_clear("First frame");
+
+    check_copied_rows("Nothing changed", -1);
+    check_copied_rows("One row changed", 7);
+    check_copied_rows("Nothing changed again", -1);
+    check_copied_rows("Last row changed", GBA_SCREEN_Y - 1);
+
+    set_render_policy(RENDER_FRAMESKIP, 2);
+    for (int frame = 0; frame < 4; frame++) {
+        check_copied_rows("Frameskip", frame % 2 ? 100 : -1);
+    }
+
+    frame_pipeline_stop();
+    return 0;
+}